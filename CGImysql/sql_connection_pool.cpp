@@ -1,10 +1,13 @@
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <stdio.h>
 #include <string>
 #include <string.h>
 #include <stdlib.h>
 #include <list>
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <iostream>
 #include "sql_connection_pool.h"
 
@@ -15,6 +18,13 @@ connection_pool::connection_pool()
 {
 	m_CurConn = 0;	//已使用的连接数
 	m_FreeConn = 0; //空闲的连接数
+	m_TotalConn = 0;
+	m_MaxConn = 0;
+	m_MinConn = 0;
+	m_stop = false;
+	m_WaitMs = 3000;
+	m_IdleTimeout = 60;
+	m_PingInterval = 30;
 }
 
 //单例模式，返回一个连接池
@@ -37,7 +47,7 @@ connection_pool *connection_pool::GetInstance()
 // clientflag：Mysql运行为ODBC数据库的标记，一般取0
 // 返回值：连接成功，返回连接句柄，即第一个变量mysql；连接失败，返回NULL
 //初始化
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log)
+bool connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log, int MinConn)
 {
 	m_url = url;					//初始化数据库信息
 	m_Port = Port;
@@ -46,55 +56,166 @@ void connection_pool::init(string url, string User, string PassWord, string DBNa
 	m_DatabaseName = DBName;
 	m_close_log = close_log;
 
-	for (int i = 0; i < MaxConn; i++)			//创建MaxConn条数据库连接
-	{
-		MYSQL *con = NULL;
-		//如果con为NULL则分配一个MYSQL对象句柄，否则将初始化con句柄数据库
-		con = mysql_init(con);					//mysql_init(MYSQL* mysql):初始化或分配与mysql_real_connect()相适应的MYSQL对象
+	m_MaxConn = MaxConn > 0 ? MaxConn : 1;
+	m_MinConn = MinConn < 0 ? 0 : (MinConn > m_MaxConn ? m_MaxConn : MinConn);
 
-		if (con == NULL)						//初始化失败
-		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
-		}
-		//创建真正的数据库连接
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
-
-		if (con == NULL)						//建立连接失败
+	//启动时只建立最小连接数，其余在取连接时按需建立
+	bool ok = true;
+	for (int i = 0; i < m_MinConn; i++)
+	{
+		MYSQL *con = CreateConn();
+		if (con == NULL)
 		{
-			LOG_ERROR("MySQL Error");
-			exit(1);
+			ok = false;
+			break;
 		}
-		//将数据库对象放入连接池中保存
-		connList.push_back(con);				//更新连接池和空闲连接数量
+		lock.lock();
+		connList.push_back(con);
 		++m_FreeConn;
+		++m_TotalConn;
+		lock.unlock();
+	}
+
+	//后台线程负责空闲回收、ping检查以及补足最小连接数
+	pthread_t tid;
+	pthread_create(&tid, NULL, maintain_thread, this);
+	pthread_detach(tid);
+	return ok;
+}
+
+//分配连接对象并建立连接，句柄由我们自己分配，重连时可在原地址上重新初始化
+MYSQL *connection_pool::CreateConn()
+{
+	pooled_conn *pc = (pooled_conn *)calloc(1, sizeof(pooled_conn));
+	MYSQL *con = pc ? &pc->mysql : NULL;
+	//如果con为NULL则分配一个MYSQL对象句柄，否则将初始化con句柄数据库
+	if (con == NULL || mysql_init(con) == NULL)	//mysql_init(MYSQL* mysql):初始化或分配与mysql_real_connect()相适应的MYSQL对象
+	{
+		LOG_ERROR("MySQL Error");
+		free(pc);
+		return NULL;
+	}
+
+	unsigned int timeout = 3;
+	mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	//创建真正的数据库连接
+	if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(), m_Port, NULL, 0) == NULL)
+	{
+		LOG_ERROR("MySQL Error:%s", mysql_error(con));
+		mysql_close(con);
+		free(con);
+		return NULL;
+	}
+	SetCloexec(con);
+
+	//为该连接预编译登录查询与注册写入语句
+	if (!PrepareStmts(con))
+	{
+		LOG_ERROR("MySQL prepare error");
 	}
+	return con;
+}
 
-	//reserve信号量代表连接池中可用的数据库连接对象
-	reserve = sem(m_FreeConn);					//将信号量初始化为最大连接次数
+void connection_pool::CloseConn(MYSQL *con)
+{
+	CloseStmts(*GetStmts(con));
+	mysql_close(con);
+	free(con);
+}
+
+//调用者持有该连接时调用：关闭旧连接后在同一句柄上重连并重新预编译
+bool connection_pool::Reconnect(MYSQL *con)
+{
+	CloseStmts(*GetStmts(con));
+	mysql_close(con);
 
-	m_MaxConn = m_FreeConn;
+	unsigned int timeout = 3;
+	if (mysql_init(con) == NULL)
+		return false;
+	mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(), m_Port, NULL, 0) == NULL)
+	{
+		LOG_ERROR("MySQL reconnect error:%s", mysql_error(con));
+		return false;
+	}
+	SetCloexec(con);
+	LOG_INFO("%s", "MySQL reconnected");
+	return PrepareStmts(con);
+}
+
+//客户端库创建的套接字不带close-on-exec，热升级exec新进程时不应继承
+void connection_pool::SetCloexec(MYSQL *con)
+{
+	int fd = mysql_get_socket(con);
+	if (fd >= 0)
+		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
 }
 
+//连接已被服务端断开或通信中断
+bool connection_pool::ConnLost(unsigned int err)
+{
+	return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
 
 //当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
 MYSQL *connection_pool::GetConnection()
 {
 	MYSQL *con = NULL;
 
-	if (0 == connList.size())
-		return NULL;
+	struct timespec deadline = {0, 0};
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += m_WaitMs / 1000;
+	deadline.tv_nsec += (m_WaitMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
 
-	reserve.wait();			//取出连接，信号量原子减1，为0则等待
-	
 	lock.lock();			//lock互斥锁保证同一时间只有一个线程对容器connlist进行操作
-	//从连接池中返回一个数据库连接对象
+	while (connList.empty())
+	{
+		//未达上限，先占住名额，在锁外建立新连接
+		if (m_TotalConn < m_MaxConn)
+		{
+			++m_TotalConn;
+			lock.unlock();
+			con = CreateConn();
+			lock.lock();
+			if (con)
+			{
+				++m_CurConn;
+				lock.unlock();
+				PROBE2(db_get, con, 0);
+				return con;
+			}
+			--m_TotalConn;
+			//数据库不可用且没有任何连接会被归还，直接返回
+			if (m_TotalConn == 0)
+			{
+				lock.unlock();
+				PROBE2(db_get, NULL, 0);
+				return NULL;
+			}
+		}
+		if (m_stop || !m_cond.timewait(lock.get(), deadline))
+		{
+			if (connList.empty())
+			{
+				lock.unlock();
+				PROBE2(db_get, NULL, 0);
+				return NULL;
+			}
+		}
+	}
+	//从连接池中返回一个数据库连接对象，头部为最近归还的连接
 	con = connList.front();		//得到第一个连接
 	connList.pop_front();		//从连接池中弹出该连接
 	//空闲连接数
 	--m_FreeConn;				
 	//已使用连接数
 	++m_CurConn;	
+	PROBE2(db_get, con, m_FreeConn);
 	lock.unlock();
 	//返回可用连接的指针
 	return con;
@@ -108,35 +229,317 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
 
 	lock.lock();
 
-	connList.push_back(con);
+	connList.push_front(con);
 	++m_FreeConn;
 	--m_CurConn;
+	GetStmts(con)->last_used = time(NULL);
+	m_cond.signal();
+	PROBE2(db_release, con, m_FreeConn);
 
 	lock.unlock();
-
-	reserve.post();		//释放连接原子加1
 	return true;
 }
 
 //销毁数据库连接池
 void connection_pool::DestroyPool()
 {
+	lock.lock();
+	m_stop = true;
+	list<MYSQL *> conns;
+	conns.swap(connList);	//通过swap取出空闲连接，在锁外关闭
+	m_TotalConn -= m_FreeConn;
+	m_FreeConn = 0;
+	m_cond.broadcast();
+	lock.unlock();
+
+	list<MYSQL *>::iterator it;
+	for (it = conns.begin(); it != conns.end(); ++it)
+		CloseConn(*it);
+}
+
+void *connection_pool::maintain_thread(void *arg)
+{
+	connection_pool *pool = (connection_pool *)arg;
+	mysql_thread_init();
+	while (true)
+	{
+		sleep(5);
+		pool->lock.lock();
+		bool stop = pool->m_stop;
+		pool->lock.unlock();
+		if (stop)
+			break;
+		pool->Maintain();
+	}
+	mysql_thread_end();
+	return NULL;
+}
+
+void connection_pool::Maintain()
+{
+	time_t now = time(NULL);
+	vector<MYSQL *> to_close;
+	vector<MYSQL *> to_check;
 
 	lock.lock();
-	if (connList.size() > 0)
+	//尾部为空闲最久的连接，超过空闲时间且多于最小连接数则关闭
+	while (!connList.empty() && m_TotalConn - (int)to_close.size() > m_MinConn)
+	{
+		MYSQL *con = connList.back();
+		if (now - GetStmts(con)->last_used < m_IdleTimeout)
+			break;
+		connList.pop_back();
+		to_close.push_back(con);
+	}
+	m_FreeConn -= to_close.size();
+	m_TotalConn -= to_close.size();
+
+	//空闲较久的连接暂时取出做健康检查，期间视为已使用
+	list<MYSQL *>::iterator it = connList.begin();
+	while (it != connList.end())
 	{
-		list<MYSQL *>::iterator it;								//通过迭代器遍历，关闭数据库连接
-		for (it = connList.begin(); it != connList.end(); ++it)
+		if (now - GetStmts(*it)->last_used >= m_PingInterval)
 		{
-			MYSQL *con = *it;
-			mysql_close(con);
+			to_check.push_back(*it);
+			it = connList.erase(it);
+			--m_FreeConn;
+			++m_CurConn;
 		}
-		m_CurConn = 0;
-		m_FreeConn = 0;
-		connList.clear();				//清空连接池
+		else
+			++it;
 	}
-
+	int lack = m_MinConn - m_TotalConn;
+	if (lack > 0)
+		m_TotalConn += lack;
 	lock.unlock();
+
+	for (size_t i = 0; i < to_close.size(); ++i)
+		CloseConn(to_close[i]);
+	if (!to_close.empty())
+		LOG_INFO("close %d idle mysql connections", (int)to_close.size());
+
+	//ping失败则原地重连，重连失败则丢弃该连接
+	for (size_t i = 0; i < to_check.size(); ++i)
+	{
+		MYSQL *con = to_check[i];
+		if (mysql_ping(con) == 0 || Reconnect(con))
+		{
+			ReleaseConnection(con);
+			continue;
+		}
+		CloseConn(con);
+		lock.lock();
+		--m_CurConn;
+		--m_TotalConn;
+		lock.unlock();
+	}
+
+	//补足最小连接数，数据库启动晚于服务器时也能自动恢复
+	for (int i = 0; i < lack; ++i)
+	{
+		MYSQL *con = CreateConn();
+		lock.lock();
+		if (con)
+		{
+			connList.push_back(con);
+			++m_FreeConn;
+			m_cond.signal();
+		}
+		else
+			--m_TotalConn;
+		lock.unlock();
+	}
+}
+
+//预编译一条语句，失败返回NULL
+static MYSQL_STMT *prepare(MYSQL *conn, const char *sql)
+{
+	MYSQL_STMT *stmt = mysql_stmt_init(conn);
+	if (stmt == NULL)
+		return NULL;
+	if (mysql_stmt_prepare(stmt, sql, strlen(sql)))
+	{
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+	return stmt;
+}
+
+//绑定一个字符串参数
+static void bind_string(MYSQL_BIND &bind, const char *str, unsigned long *length)
+{
+	memset(&bind, 0, sizeof(bind));
+	*length = strlen(str);
+	bind.buffer_type = MYSQL_TYPE_STRING;
+	bind.buffer = (void *)str;
+	bind.buffer_length = *length;
+	bind.length = length;
+}
+
+bool connection_pool::PrepareStmts(MYSQL *conn)
+{
+	prepared_stmts &stmts = *GetStmts(conn);
+	memset(&stmts, 0, sizeof(stmts));
+	stmts.login = prepare(conn, "SELECT passwd FROM user WHERE username=? LIMIT 1");
+	stmts.insert = prepare(conn, "INSERT INTO user(username, passwd) VALUES(?, ?)");
+	stmts.last_used = time(NULL);
+	return stmts.login && stmts.insert;
+}
+
+void connection_pool::CloseStmts(prepared_stmts &stmts)
+{
+	if (stmts.login)
+		mysql_stmt_close(stmts.login);
+	if (stmts.insert)
+		mysql_stmt_close(stmts.insert);
+	for (int i = 0; i < BATCH_STMTS; ++i)
+	{
+		if (stmts.batch_insert[i])
+			mysql_stmt_close(stmts.batch_insert[i]);
+		stmts.batch_insert[i] = NULL;
+	}
+	stmts.login = stmts.insert = NULL;
+}
+
+//取rows(2的幂)行的多行INSERT语句，首次使用时预编译；只有持有该连接的线程会访问
+MYSQL_STMT *connection_pool::GetBatchStmt(MYSQL *conn, int rows)
+{
+	prepared_stmts *stmts = GetStmts(conn);
+	int idx = __builtin_ctz(rows);
+	if (idx >= BATCH_STMTS)
+		return NULL;
+	if (stmts->batch_insert[idx])
+		return stmts->batch_insert[idx];
+
+	string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+	for (int i = 1; i < rows; ++i)
+		sql += ",(?, ?)";
+	MYSQL_STMT *stmt = prepare(conn, sql.c_str());
+	stmts->batch_insert[idx] = stmt;
+	return stmt;
+}
+
+int connection_pool::InsertUser(MYSQL *conn, const char *name, const char *passwd)
+{
+	if (conn == NULL)
+		return -1;
+
+	MYSQL_BIND params[2];
+	unsigned long lengths[2];
+	bind_string(params[0], name, &lengths[0]);
+	bind_string(params[1], passwd, &lengths[1]);
+
+	for (int retry = 0;; ++retry)
+	{
+		prepared_stmts *stmts = GetStmts(conn);
+		if (stmts->insert == NULL)
+			return -1;
+
+		if (!mysql_stmt_bind_param(stmts->insert, params) && !mysql_stmt_execute(stmts->insert))
+			return 0;
+
+		unsigned int err = mysql_stmt_errno(stmts->insert);
+		LOG_ERROR("INSERT error:%s", mysql_stmt_error(stmts->insert));
+		//连接已被服务端断开则原地重连后重试一次
+		if (retry > 0 || !ConnLost(err) || !Reconnect(conn))
+			return err ? (int)err : -1;
+	}
+}
+
+int connection_pool::InsertUsers(MYSQL *conn, const vector<pair<string, string> > &rows)
+{
+	if (conn == NULL)
+		return 0;
+
+	//按2的幂拆分，每条连接最多预编译log2(n)条多行语句
+	size_t done = 0;
+	while (done < rows.size())
+	{
+		int n = 1;
+		while ((size_t)n * 2 <= rows.size() - done && n < 64)
+			n *= 2;
+		if (n == 1)
+		{
+			if (InsertUser(conn, rows[done].first.c_str(), rows[done].second.c_str()) != 0)
+				return done;
+			++done;
+			continue;
+		}
+
+		vector<MYSQL_BIND> params(n * 2);
+		vector<unsigned long> lengths(n * 2);
+		for (int i = 0; i < n; ++i)
+		{
+			bind_string(params[i * 2], rows[done + i].first.c_str(), &lengths[i * 2]);
+			bind_string(params[i * 2 + 1], rows[done + i].second.c_str(), &lengths[i * 2 + 1]);
+		}
+
+		for (int retry = 0;; ++retry)
+		{
+			MYSQL_STMT *stmt = GetBatchStmt(conn, n);
+			if (stmt == NULL)
+				return done;
+			if (!mysql_stmt_bind_param(stmt, &params[0]) && !mysql_stmt_execute(stmt))
+				break;
+
+			unsigned int err = mysql_stmt_errno(stmt);
+			LOG_ERROR("INSERT batch error:%s", mysql_stmt_error(stmt));
+			if (retry > 0 || !ConnLost(err) || !Reconnect(conn))
+				return done;
+		}
+		done += n;
+	}
+	return done;
+}
+
+int connection_pool::QueryUserPasswd(MYSQL *conn, const char *name, string &passwd)
+{
+	if (conn == NULL)
+		return -1;
+
+	MYSQL_BIND param;
+	unsigned long name_len;
+	bind_string(param, name, &name_len);
+
+	char buf[100];
+	unsigned long buf_len = 0;
+	MYSQL_BIND result;
+	memset(&result, 0, sizeof(result));
+	result.buffer_type = MYSQL_TYPE_STRING;
+	result.buffer = buf;
+	result.buffer_length = sizeof(buf);
+	result.length = &buf_len;
+
+	MYSQL_STMT *stmt = NULL;
+	for (int retry = 0;; ++retry)
+	{
+		prepared_stmts *stmts = GetStmts(conn);
+		if (stmts->login == NULL)
+			return -1;
+		stmt = stmts->login;
+
+		if (!mysql_stmt_bind_param(stmt, &param) && !mysql_stmt_execute(stmt) &&
+			!mysql_stmt_bind_result(stmt, &result) && !mysql_stmt_store_result(stmt))
+			break;
+
+		unsigned int err = mysql_stmt_errno(stmt);
+		LOG_ERROR("SELECT error:%s", mysql_stmt_error(stmt));
+		mysql_stmt_reset(stmt);
+		//连接已被服务端断开则原地重连后重试一次
+		if (retry > 0 || !ConnLost(err) || !Reconnect(conn))
+			return -1;
+	}
+
+	int ret = 0;
+	int status = mysql_stmt_fetch(stmt);
+	if (status == 0 || status == MYSQL_DATA_TRUNCATED)
+	{
+		passwd.assign(buf, buf_len < sizeof(buf) ? buf_len : sizeof(buf));
+		ret = 1;
+	}
+	mysql_stmt_free_result(stmt);
+	mysql_stmt_reset(stmt);
+	return ret;
 }
 
 //当前空闲的连接数
@@ -145,6 +548,11 @@ int connection_pool::GetFreeConn()
 	return this->m_FreeConn;
 }
 
+int connection_pool::GetTotalConn()
+{
+	return this->m_TotalConn;
+}
+
 connection_pool::~connection_pool()
 {
 	DestroyPool();
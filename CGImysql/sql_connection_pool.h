@@ -8,38 +8,85 @@
 #include <string.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <time.h>
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "../trace/probes.h"
 
 using namespace std;
 
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
+	MYSQL *GetConnection();				 //获取数据库连接，无空闲且未达上限时新建，超时返回NULL
 	bool ReleaseConnection(MYSQL *conn); //释放连接
 	int GetFreeConn();					 //获取连接
+	int GetTotalConn();					 //当前已建立的连接总数
 	void DestroyPool();					 //销毁所有连接
 
+	//使用连接上预编译的语句，参数绑定执行，不再拼接SQL
+	int InsertUser(MYSQL *conn, const char *name, const char *passwd);		//注册写入，成功返回0，失败返回mysql错误码，没有可用的连接或语句返回-1
+	int InsertUsers(MYSQL *conn, const vector<pair<string, string> > &rows);  //多行写入，按2的幂拆分为若干条多行INSERT，返回从头起已写入的行数
+	int QueryUserPasswd(MYSQL *conn, const char *name, string &passwd);	//登录查询，找到返回1，不存在返回0，出错返回-1
+
 	//单例模式
 	static connection_pool *GetInstance();
 
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log); 
+	//启动时只建立MinConn条连接，之后按需增长到MaxConn；连不上数据库不再退出，由后台线程重试
+	bool init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log, int MinConn = 2);
 
 private:
 	connection_pool();
 	~connection_pool();
 
+	static void *maintain_thread(void *arg);
+	void Maintain();					 //空闲回收、健康检查与补足最小连接数
+
+	MYSQL *CreateConn();				 //新建一条连接并预编译语句，失败返回NULL
+	void CloseConn(MYSQL *conn);		 //关闭语句与连接并释放句柄
+	bool Reconnect(MYSQL *conn);		 //在原句柄上重连，句柄地址不变
+	static bool ConnLost(unsigned int err); //错误码表示连接已断开
+	static void SetCloexec(MYSQL *con);		//连接套接字设为close-on-exec
+
 	int m_MaxConn;  //最大连接数
+	int m_MinConn;  //最小连接数
 	int m_CurConn;  //当前已使用的连接数
 	int m_FreeConn; //当前空闲的连接数
+	int m_TotalConn; //已建立及正在建立的连接数
 	locker lock;
-	list<MYSQL *> connList; //连接池
-	sem reserve;
+	cond m_cond;	//有连接归还时唤醒等待者
+	list<MYSQL *> connList; //空闲连接，归还放在头部，尾部为空闲最久的连接
+	bool m_stop;
+
+	int m_WaitMs;		 //取连接最长等待时间
+	int m_IdleTimeout;	 //空闲超过该秒数且多于最小连接数时关闭
+	int m_PingInterval;	 //空闲超过该秒数的连接由后台线程ping一次
+
+	static const int BATCH_STMTS = 7;	//多行INSERT最多64行，按行数的log2存放
+
+	//每条连接各自的预编译语句与最近使用时间，只有持有该连接的线程会访问语句
+	struct prepared_stmts
+	{
+		MYSQL_STMT *login;	//SELECT passwd FROM user WHERE username=?
+		MYSQL_STMT *insert; //INSERT INTO user(username, passwd) VALUES(?, ?)
+		MYSQL_STMT *batch_insert[BATCH_STMTS]; //2^i行的多行INSERT，按需预编译
+		time_t last_used;
+	};
+	//池中的连接：MYSQL句柄为第一个成员，句柄地址即连接对象地址，语句随连接保存，取用时不查表、不加锁
+	struct pooled_conn
+	{
+		MYSQL mysql;
+		prepared_stmts stmts;
+	};
+	static prepared_stmts *GetStmts(MYSQL *conn) { return &((pooled_conn *)conn)->stmts; }
+	static void CloseStmts(prepared_stmts &stmts);
+	static MYSQL_STMT *GetBatchStmt(MYSQL *conn, int rows);
+	static bool PrepareStmts(MYSQL *conn);
 
 public:
 	string m_url;			 //主机地址
-	string m_Port;		 //数据库端口号
+	int m_Port;			 //数据库端口号
 	string m_User;		 //登陆数据库用户名
 	string m_PassWord;	 //登陆数据库密码
 	string m_DatabaseName; //使用数据库名
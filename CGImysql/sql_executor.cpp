@@ -0,0 +1,106 @@
+#include <exception>
+#include "sql_executor.h"
+
+using namespace std;
+
+sql_executor::sql_executor(int thread_number, int max_tasks)
+	: m_thread_number(thread_number), m_max_tasks(max_tasks), m_threads(NULL), m_stop(false), m_joined(false)
+{
+	if (thread_number <= 0 || max_tasks <= 0)
+		throw std::exception();
+	m_threads = new pthread_t[m_thread_number];
+	for (int i = 0; i < thread_number; ++i)
+	{
+		//不分离，停止时逐个join，保证析构时没有线程还在访问执行器和存储后端
+		if (pthread_create(m_threads + i, NULL, worker, this) != 0)
+		{
+			m_thread_number = i;
+			stop();
+			delete[] m_threads;
+			throw std::exception();
+		}
+	}
+}
+
+sql_executor::~sql_executor()
+{
+	stop();
+	delete[] m_threads;
+}
+
+void sql_executor::stop()
+{
+	m_lock.lock();
+	if (m_joined)
+	{
+		m_lock.unlock();
+		return;
+	}
+	m_stop = true;
+	m_joined = true;
+	m_lock.unlock();
+	//每个线程一次唤醒，取完队列后看到停止标志退出
+	for (int i = 0; i < m_thread_number; ++i)
+		m_taskstat.post();
+	for (int i = 0; i < m_thread_number; ++i)
+		pthread_join(m_threads[i], NULL);
+}
+
+bool sql_executor::submit(void (*run)(void *), void *arg)
+{
+	sql_task task;
+	task.run = run;
+	task.arg = arg;
+
+	m_lock.lock();
+	if (m_stop || (int)m_tasks.size() >= m_max_tasks)
+	{
+		m_lock.unlock();
+		return false;
+	}
+	m_tasks.push_back(task);
+	m_lock.unlock();
+	m_taskstat.post();
+	return true;
+}
+
+int sql_executor::pending()
+{
+	m_lock.lock();
+	int n = m_tasks.size();
+	m_lock.unlock();
+	return n;
+}
+
+void *sql_executor::worker(void *arg)
+{
+	sql_executor *executor = (sql_executor *)arg;
+	//存储后端可能使用mysql客户端库，线程需要初始化线程相关数据
+	mysql_thread_init();
+	executor->run();
+	mysql_thread_end();
+	return executor;
+}
+
+void sql_executor::run()
+{
+	while (true)
+	{
+		m_taskstat.wait();
+		m_lock.lock();
+		if (m_tasks.empty())
+		{
+			bool stop = m_stop;
+			m_lock.unlock();
+			if (stop)
+				break;
+			continue;
+		}
+		sql_task task = m_tasks.front();
+		m_tasks.pop_front();
+		m_lock.unlock();
+
+		//MySQL后端在任务内部按需从连接池取连接，执行完立即归还
+		task.run(task.arg);
+	}
+}
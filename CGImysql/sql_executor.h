@@ -0,0 +1,49 @@
+#ifndef _SQL_EXECUTOR_
+#define _SQL_EXECUTOR_
+
+#include <list>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//数据库任务：run在数据库线程中执行，通过存储后端访问数据
+struct sql_task
+{
+	void (*run)(void *arg);
+	void *arg;
+};
+
+//数据库执行器：独立的数据库线程池
+//http工作线程只负责提交任务，阻塞的mysql调用全部在这里执行，
+//任务完成后由回调恢复对应连接的处理，数据库延迟不再占用http工作线程
+class sql_executor
+{
+public:
+	sql_executor(int thread_number = 4, int max_tasks = 10000);
+	~sql_executor();
+
+	//提交任务，队列满或已停止返回false
+	bool submit(void (*run)(void *), void *arg);
+	//不再接收新任务，等已提交的任务执行完、全部线程退出后返回
+	void stop();
+	//当前排队的任务数
+	int pending();
+
+private:
+	static void *worker(void *arg);
+	void run();
+
+private:
+	int m_thread_number;
+	int m_max_tasks;
+	pthread_t *m_threads;
+	list<sql_task> m_tasks;
+	locker m_lock;
+	sem m_taskstat;
+	bool m_stop;
+	bool m_joined;
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <mysql/mysqld_error.h>
+#include "user_store.h"
+
+using namespace std;
+
+user_store *user_store::create(int backend, connection_pool *connPool, const char *path, int close_log)
+{
+	if (STORE_MYSQL == backend)
+		return new mysql_store(connPool);
+	if (STORE_MEMORY == backend)
+		return new memory_store;
+	if (STORE_FILE == backend)
+	{
+		file_store *store = new file_store(close_log);
+		if (store->open(path))
+			return store;
+		delete store;
+	}
+	return NULL;
+}
+
+bool user_store::refresh(const char *name, user_table *users)
+{
+	string passwd;
+	int ret = query(name, passwd);
+	if (ret < 0)
+		return false;
+	users->erase(name);
+	if (ret == 1)
+		users->insert(name, passwd.c_str());
+	return true;
+}
+
+bool mysql_store::load(user_table *users)
+{
+	//先从连接池中取一个连接
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	//数据库暂不可用时跳过预加载，内存表为空，之前注册的用户需重启后才能登录
+	if (!mysql)
+		return false;
+
+	//在user表中检索username，passwd数据，浏览器端输入
+	if (mysql_query(mysql, "SELECT username,passwd FROM user"))
+	{
+		LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+		return false;
+	}
+
+	//从表中检索完整的结果集
+	MYSQL_RES *result = mysql_store_result(mysql);
+	if (!result)
+		return false;
+
+	//从结果集中获取下一行，将对应的用户名和密码，存入分片哈希表中
+	while (MYSQL_ROW row = mysql_fetch_row(result))
+	{
+		users->insert(row[0], row[1]);
+	}
+	mysql_free_result(result);
+	return true;
+}
+
+user_store::INSERT_RESULT mysql_store::insert(const char *name, const char *passwd)
+{
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	int err = m_connPool->InsertUser(mysql, name, passwd);
+	switch (err)
+	{
+	case 0:
+		return INSERT_OK;
+	case ER_DUP_ENTRY:
+		return INSERT_EXISTS;
+	case ER_BAD_NULL_ERROR:
+	case WARN_DATA_TRUNCATED:
+	case ER_TRUNCATED_WRONG_VALUE_FOR_FIELD:
+	case ER_DATA_TOO_LONG:
+		return INSERT_INVALID;
+	default:	//连接断开、锁等待超时等，稍后重试
+		return INSERT_ERROR;
+	}
+}
+
+int mysql_store::insert_batch(const vector<pair<string, string> > &rows)
+{
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	return m_connPool->InsertUsers(mysql, rows);
+}
+
+int mysql_store::query(const char *name, string &passwd)
+{
+	MYSQL *mysql = NULL;
+	connectionRAII mysqlcon(&mysql, m_connPool);
+	return m_connPool->QueryUserPasswd(mysql, name, passwd);
+}
+
+//记录头：校验和覆盖长度字段与数据，回放时据此识别写了一半的尾部记录
+static const size_t RECORD_HEAD = 8;
+static const size_t MAX_FIELD = 0xffff;
+
+static uint32_t record_sum(const char *data, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= (unsigned char)data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+file_store::file_store(int close_log, bool sync)
+	: m_fd(-1), m_size(0), m_sync(sync), m_close_log(close_log)
+{
+}
+
+file_store::~file_store()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+}
+
+bool file_store::open(const char *path)
+{
+	m_fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (m_fd < 0)
+	{
+		LOG_ERROR("open user store %s failed, errno is:%d", path, errno);
+		return false;
+	}
+	return true;
+}
+
+bool file_store::load(user_table *users)
+{
+	struct stat st;
+	if (fstat(m_fd, &st) < 0)
+		return false;
+
+	string data(st.st_size, '\0');
+	size_t got = 0;
+	while (got < data.size())
+	{
+		ssize_t n = pread(m_fd, &data[got], data.size() - got, got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
+
+	m_lock.lock();
+	size_t pos = 0;
+	while (pos + RECORD_HEAD <= got)
+	{
+		const unsigned char *head = (const unsigned char *)data.data() + pos;
+		uint32_t sum = head[0] | head[1] << 8 | head[2] << 16 | (uint32_t)head[3] << 24;
+		size_t name_len = head[4] | head[5] << 8;
+		size_t passwd_len = head[6] | head[7] << 8;
+		size_t len = RECORD_HEAD + name_len + passwd_len;
+		if (pos + len > got || record_sum(data.data() + pos + 4, len - 4) != sum)
+			break;
+
+		string name(data, pos + RECORD_HEAD, name_len);
+		string passwd(data, pos + RECORD_HEAD + name_len, passwd_len);
+		users->insert(name.c_str(), passwd.c_str());
+		m_index[name].swap(passwd);
+		pos += len;
+	}
+
+	//丢弃崩溃时写了一半的尾部，之后的追加从有效末尾继续
+	if (pos < (size_t)st.st_size)
+	{
+		LOG_ERROR("user store truncated %ld bytes of torn records", (long)(st.st_size - pos));
+		if (ftruncate(m_fd, pos) < 0)
+		{
+			m_lock.unlock();
+			return false;
+		}
+	}
+	m_size = pos;
+	LOG_INFO("user store loaded %d users", (int)m_index.size());
+	m_lock.unlock();
+	return true;
+}
+
+void file_store::encode(string &buf, const string &name, const string &passwd)
+{
+	size_t start = buf.size();
+	buf.resize(start + RECORD_HEAD);
+	buf[start + 4] = name.size() & 0xff;
+	buf[start + 5] = name.size() >> 8;
+	buf[start + 6] = passwd.size() & 0xff;
+	buf[start + 7] = passwd.size() >> 8;
+	buf += name;
+	buf += passwd;
+	uint32_t sum = record_sum(buf.data() + start + 4, buf.size() - start - 4);
+	for (int i = 0; i < 4; ++i)
+		buf[start + i] = (sum >> (i * 8)) & 0xff;
+}
+
+//持有m_lock时调用
+bool file_store::append(const string &buf)
+{
+	size_t done = 0;
+	while (done < buf.size())
+	{
+		ssize_t n = pwrite(m_fd, buf.data() + done, buf.size() - done, m_size + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	if (done == buf.size() && (!m_sync || fdatasync(m_fd) == 0))
+	{
+		m_size += done;
+		return true;
+	}
+	LOG_ERROR("user store write failed, errno is:%d", errno);
+	//撤销写了一半的记录，保证文件末尾始终是完整记录
+	if (ftruncate(m_fd, m_size) < 0)
+		LOG_ERROR("user store truncate failed, errno is:%d", errno);
+	return false;
+}
+
+user_store::INSERT_RESULT file_store::insert(const char *name, const char *passwd)
+{
+	string key(name), value(passwd);
+	if (key.size() > MAX_FIELD || value.size() > MAX_FIELD)
+		return INSERT_INVALID;
+
+	m_lock.lock();
+	INSERT_RESULT ret = INSERT_EXISTS;
+	if (m_index.find(key) == m_index.end())
+	{
+		string buf;
+		encode(buf, key, value);
+		ret = append(buf) ? INSERT_OK : INSERT_ERROR;
+		if (INSERT_OK == ret)
+			m_index[key].swap(value);
+	}
+	m_lock.unlock();
+	return ret;
+}
+
+//一批记录一次写入、一次落盘；已存在的用户直接跳过
+//遇到超长的行只写入它之前的部分，由调用方逐行处理
+int file_store::insert_batch(const vector<pair<string, string> > &rows)
+{
+	size_t n = 0;
+	while (n < rows.size() && rows[n].first.size() <= MAX_FIELD && rows[n].second.size() <= MAX_FIELD)
+		++n;
+
+	string buf;
+	vector<size_t> added;
+	m_lock.lock();
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (m_index.insert(rows[i]).second)
+		{
+			encode(buf, rows[i].first, rows[i].second);
+			added.push_back(i);
+		}
+	}
+	if (!buf.empty() && !append(buf))
+	{
+		for (size_t i = 0; i < added.size(); ++i)
+			m_index.erase(rows[added[i]].first);
+		m_lock.unlock();
+		return 0;
+	}
+	m_lock.unlock();
+	return n;
+}
+
+int file_store::query(const char *name, string &passwd)
+{
+	m_lock.lock();
+	unordered_map<string, string>::iterator it = m_index.find(name);
+	int ret = 0;
+	if (it != m_index.end())
+	{
+		passwd = it->second;
+		ret = 1;
+	}
+	m_lock.unlock();
+	return ret;
+}
+
+user_store::INSERT_RESULT memory_store::insert(const char *name, const char *passwd)
+{
+	m_lock.lock();
+	bool ok = m_users.insert(make_pair(string(name), string(passwd))).second;
+	m_lock.unlock();
+	return ok ? INSERT_OK : INSERT_EXISTS;
+}
+
+int memory_store::insert_batch(const vector<pair<string, string> > &rows)
+{
+	m_lock.lock();
+	for (size_t i = 0; i < rows.size(); ++i)
+		m_users.insert(rows[i]);
+	m_lock.unlock();
+	return rows.size();
+}
+
+int memory_store::query(const char *name, string &passwd)
+{
+	m_lock.lock();
+	unordered_map<string, string>::iterator it = m_users.find(name);
+	int ret = 0;
+	if (it != m_users.end())
+	{
+		passwd = it->second;
+		ret = 1;
+	}
+	m_lock.unlock();
+	return ret;
+}
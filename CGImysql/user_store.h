@@ -0,0 +1,119 @@
+#ifndef _USER_STORE_
+#define _USER_STORE_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+#include "user_table.h"
+
+using namespace std;
+
+//用户凭据存储后端，登录/注册只通过该接口访问持久化数据
+//接口均为阻塞调用，由数据库执行器线程或后写线程调用
+class user_store
+{
+public:
+	enum BACKEND
+	{
+		STORE_MYSQL = 0,
+		STORE_FILE,
+		STORE_MEMORY
+	};
+
+	//单个用户的写入结果
+	enum INSERT_RESULT
+	{
+		INSERT_OK = 0,	 //已写入
+		INSERT_EXISTS,	 //用户名已存在
+		INSERT_INVALID,	 //数据被存储拒绝(如超长)，重试也不会成功
+		INSERT_ERROR	 //存储暂不可用，可以重试
+	};
+
+	virtual ~user_store() {}
+
+	//启动时把全部用户加载到内存表
+	virtual bool load(user_table *users) = 0;
+	//写入一个用户
+	virtual INSERT_RESULT insert(const char *name, const char *passwd) = 0;
+	//批量写入，返回从头起已写入的行数，已存在的用户按已写入计；失败的行可用insert逐行确定原因
+	virtual int insert_batch(const vector<pair<string, string> > &rows) = 0;
+	//查询密码，找到返回1，不存在返回0，出错返回-1
+	virtual int query(const char *name, string &passwd) = 0;
+	virtual const char *name() const = 0;
+
+	//按存储中的数据更新内存表中的该用户，用户名已被其他实例注册时使用；查询出错返回false
+	bool refresh(const char *name, user_table *users);
+
+	//按后端类型创建，失败返回NULL
+	static user_store *create(int backend, connection_pool *connPool, const char *path, int close_log);
+};
+
+//MySQL后端：每次操作从连接池取连接，使用连接上的预编译语句
+class mysql_store : public user_store
+{
+public:
+	mysql_store(connection_pool *connPool) : m_connPool(connPool), m_close_log(connPool->m_close_log) {}
+
+	bool load(user_table *users);
+	INSERT_RESULT insert(const char *name, const char *passwd);
+	int insert_batch(const vector<pair<string, string> > &rows);
+	int query(const char *name, string &passwd);
+	const char *name() const { return "mysql"; }
+
+private:
+	connection_pool *m_connPool;
+	int m_close_log;
+};
+
+//本地日志结构文件后端：只追加写，启动时顺序回放重建索引
+//记录格式：校验和(4) 用户名长度(2) 密码长度(2) 用户名 密码
+//回放遇到不完整或校验失败的尾部记录(写入时崩溃)即截断，之后的追加从该处继续
+class file_store : public user_store
+{
+public:
+	file_store(int close_log, bool sync = true);
+	~file_store();
+
+	//打开或创建数据文件，失败返回false
+	bool open(const char *path);
+
+	bool load(user_table *users);
+	INSERT_RESULT insert(const char *name, const char *passwd);
+	int insert_batch(const vector<pair<string, string> > &rows);
+	int query(const char *name, string &passwd);
+	const char *name() const { return "file"; }
+
+private:
+	//把一条记录编码追加到buf
+	static void encode(string &buf, const string &name, const string &passwd);
+	//写入缓冲区并按需落盘，失败时截断到写入前的长度
+	bool append(const string &buf);
+
+private:
+	int m_fd;
+	off_t m_size;	//已写入的有效长度
+	bool m_sync;	//每次写入后fdatasync
+	int m_close_log;
+	unordered_map<string, string> m_index;
+	locker m_lock;
+};
+
+//内存后端：不持久化，用于压测与本地调试
+class memory_store : public user_store
+{
+public:
+	bool load(user_table *users) { return true; }
+	INSERT_RESULT insert(const char *name, const char *passwd);
+	int insert_batch(const vector<pair<string, string> > &rows);
+	int query(const char *name, string &passwd);
+	const char *name() const { return "memory"; }
+
+private:
+	unordered_map<string, string> m_users;
+	locker m_lock;
+};
+
+#endif
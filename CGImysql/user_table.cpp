@@ -0,0 +1,300 @@
+#include <string.h>
+#include <time.h>
+#include "user_table.h"
+
+using namespace std;
+
+//本线程在m_readers中的槽位，首次查找时分配
+static thread_local int t_reader = -1;
+
+user_table::user_table()
+{
+	for (int i = 0; i < SHARD_NUM; ++i)
+	{
+		table *tab = new table;
+		tab->mask = INIT_CAPACITY - 1;
+		tab->slots = new atomic<entry *>[INIT_CAPACITY];
+		for (size_t j = 0; j < INIT_CAPACITY; ++j)
+			tab->slots[j].store(NULL, memory_order_relaxed);
+		m_shards[i].tab.store(tab, memory_order_release);
+		m_shards[i].used = 0;
+		m_shards[i].count = 0;
+	}
+	m_epoch.store(1, memory_order_relaxed);
+	m_reader_num.store(0, memory_order_relaxed);
+	for (int i = 0; i < MAX_READERS; ++i)
+		m_readers[i].epoch.store(0, memory_order_relaxed);
+}
+
+user_table::~user_table()
+{
+	for (int i = 0; i < SHARD_NUM; ++i)
+	{
+		shard &sh = m_shards[i];
+		table *tab = sh.tab.load();
+		for (size_t j = 0; j <= tab->mask; ++j)
+		{
+			entry *e = tab->slots[j].load();
+			if (e && e != tombstone())
+				delete e;
+		}
+		delete[] tab->slots;
+		delete tab;
+		for (size_t j = 0; j < sh.retired.size(); ++j)
+		{
+			delete[] sh.retired[j].second->slots;
+			delete sh.retired[j].second;
+		}
+		for (size_t j = 0; j < sh.removed.size(); ++j)
+			delete sh.removed[j].second;
+	}
+}
+
+//单例模式
+user_table *user_table::GetInstance()
+{
+	static user_table table;
+	return &table;
+}
+
+//FNV-1a，直接作用于char*，查找时无需构造string
+size_t user_table::hash_of(const char *name, size_t len)
+{
+	size_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+user_table::read_guard::read_guard(user_table *t, shard &sh) : m_reader(NULL), m_locked(NULL)
+{
+	if (t_reader < 0)
+		t_reader = t->m_reader_num.fetch_add(1, memory_order_relaxed);
+	if (t_reader >= MAX_READERS)
+	{
+		sh.lock.lock();
+		m_locked = &sh;
+		return;
+	}
+	//登记之后再确认epoch没有推进，否则回收线程可能已经按旧的登记值(0)释放了对象，换成新值重新登记
+	m_reader = &t->m_readers[t_reader];
+	uint64_t e = t->m_epoch.load(memory_order_seq_cst);
+	while (true)
+	{
+		m_reader->epoch.store(e, memory_order_seq_cst);
+		uint64_t cur = t->m_epoch.load(memory_order_seq_cst);
+		if (cur == e)
+			break;
+		e = cur;
+	}
+}
+
+user_table::read_guard::~read_guard()
+{
+	if (m_reader)
+		m_reader->epoch.store(0, memory_order_release);
+	else
+		m_locked->lock.unlock();
+}
+
+//无锁查找：原子读取当前表，线性探测直到遇到空槽；调用方持有read_guard
+const user_table::entry *user_table::lookup(shard &sh, size_t hash, const char *name, size_t len)
+{
+	table *tab = sh.tab.load(memory_order_acquire);
+	for (size_t i = hash & tab->mask;; i = (i + 1) & tab->mask)
+	{
+		entry *e = tab->slots[i].load(memory_order_acquire);
+		if (e == NULL)
+			return NULL;
+		if (e != tombstone() && e->hash == hash && e->name.size() == len &&
+			memcmp(e->name.data(), name, len) == 0)
+			return e;
+	}
+}
+
+bool user_table::find(const char *name, string &passwd)
+{
+	size_t len = strlen(name);
+	size_t hash = hash_of(name, len);
+	shard &sh = shard_of(hash);
+	read_guard guard(this, sh);
+	const entry *e = lookup(sh, hash, name, len);
+	if (!e)
+		return false;
+	passwd = e->passwd;
+	return true;
+}
+
+bool user_table::check(const char *name, const char *passwd)
+{
+	size_t len = strlen(name);
+	size_t hash = hash_of(name, len);
+	shard &sh = shard_of(hash);
+	read_guard guard(this, sh);
+	const entry *e = lookup(sh, hash, name, len);
+	return e && e->passwd == passwd;
+}
+
+bool user_table::insert(const char *name, const char *passwd)
+{
+	size_t len = strlen(name);
+	size_t hash = hash_of(name, len);
+	shard &sh = shard_of(hash);
+
+	sh.lock.lock();
+	//装载因子(含删除标记)不超过1/2，保证探测链短且一定存在空槽
+	table *tab = sh.tab.load(memory_order_relaxed);
+	if ((sh.used + 1) * 2 > tab->mask + 1)
+	{
+		grow(sh);
+		tab = sh.tab.load(memory_order_relaxed);
+	}
+
+	size_t slot = tab->mask + 1;
+	for (size_t i = hash & tab->mask;; i = (i + 1) & tab->mask)
+	{
+		entry *e = tab->slots[i].load(memory_order_relaxed);
+		if (e == NULL)
+		{
+			if (slot > tab->mask)
+				slot = i;
+			break;
+		}
+		if (e == tombstone())
+		{
+			if (slot > tab->mask)
+				slot = i;
+			continue;
+		}
+		if (e->hash == hash && e->name.size() == len && memcmp(e->name.data(), name, len) == 0)
+		{
+			sh.lock.unlock();
+			return false;
+		}
+	}
+
+	entry *e = new entry;
+	e->hash = hash;
+	e->name.assign(name, len);
+	e->passwd = passwd;
+	if (tab->slots[slot].load(memory_order_relaxed) == NULL)
+		++sh.used;
+	//release保证读线程看到指针时记录内容已完整
+	tab->slots[slot].store(e, memory_order_release);
+	++sh.count;
+	sh.lock.unlock();
+	return true;
+}
+
+bool user_table::erase(const char *name)
+{
+	size_t len = strlen(name);
+	size_t hash = hash_of(name, len);
+	shard &sh = shard_of(hash);
+
+	sh.lock.lock();
+	table *tab = sh.tab.load(memory_order_relaxed);
+	for (size_t i = hash & tab->mask;; i = (i + 1) & tab->mask)
+	{
+		entry *e = tab->slots[i].load(memory_order_relaxed);
+		if (e == NULL)
+			break;
+		if (e != tombstone() && e->hash == hash && e->name.size() == len &&
+			memcmp(e->name.data(), name, len) == 0)
+		{
+			//读线程可能仍持有该记录，等它们都离开之后再释放
+			tab->slots[i].store(tombstone(), memory_order_release);
+			sh.removed.push_back(make_pair(retire_epoch(), e));
+			--sh.count;
+			reclaim(sh);
+			sh.lock.unlock();
+			return true;
+		}
+	}
+	sh.lock.unlock();
+	return false;
+}
+
+int user_table::size()
+{
+	int total = 0;
+	for (int i = 0; i < SHARD_NUM; ++i)
+	{
+		m_shards[i].lock.lock();
+		total += m_shards[i].count;
+		m_shards[i].lock.unlock();
+	}
+	return total;
+}
+
+//持有分片锁时调用：按有效记录数重建一张更大的表并发布
+void user_table::grow(shard &sh)
+{
+	table *old_tab = sh.tab.load(memory_order_relaxed);
+	size_t cap = old_tab->mask + 1;
+	while ((size_t)(sh.count + 1) * 4 > cap)
+		cap <<= 1;
+
+	table *tab = new table;
+	tab->mask = cap - 1;
+	tab->slots = new atomic<entry *>[cap];
+	for (size_t i = 0; i < cap; ++i)
+		tab->slots[i].store(NULL, memory_order_relaxed);
+
+	for (size_t i = 0; i <= old_tab->mask; ++i)
+	{
+		entry *e = old_tab->slots[i].load(memory_order_relaxed);
+		if (e == NULL || e == tombstone())
+			continue;
+		size_t j = e->hash & tab->mask;
+		while (tab->slots[j].load(memory_order_relaxed) != NULL)
+			j = (j + 1) & tab->mask;
+		tab->slots[j].store(e, memory_order_relaxed);
+	}
+
+	sh.tab.store(tab, memory_order_release);
+	sh.used = sh.count;
+	sh.retired.push_back(make_pair(retire_epoch(), old_tab));
+	reclaim(sh);
+}
+
+//登记的epoch大于摘除时epoch的线程是在摘除之后开始查找的，访问不到该对象
+void user_table::reclaim(shard &sh)
+{
+	uint64_t oldest = UINT64_MAX;
+	int n = m_reader_num.load(memory_order_relaxed);
+	if (n > MAX_READERS)
+		n = MAX_READERS;
+	for (int i = 0; i < n; ++i)
+	{
+		uint64_t e = m_readers[i].epoch.load(memory_order_seq_cst);
+		if (e && e < oldest)
+			oldest = e;
+	}
+
+	size_t keep = 0;
+	for (size_t i = 0; i < sh.retired.size(); ++i)
+	{
+		if (sh.retired[i].first < oldest)
+		{
+			delete[] sh.retired[i].second->slots;
+			delete sh.retired[i].second;
+		}
+		else
+			sh.retired[keep++] = sh.retired[i];
+	}
+	sh.retired.resize(keep);
+
+	keep = 0;
+	for (size_t i = 0; i < sh.removed.size(); ++i)
+	{
+		if (sh.removed[i].first < oldest)
+			delete sh.removed[i].second;
+		else
+			sh.removed[keep++] = sh.removed[i];
+	}
+	sh.removed.resize(keep);
+}
@@ -0,0 +1,103 @@
+#ifndef _USER_TABLE_
+#define _USER_TABLE_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//内存中的用户名/密码表
+//按哈希分为SHARD_NUM个分片，每个分片是一张开放寻址(线性探测)哈希表
+//读：不加锁，原子读取槽位指针即可，登录校验可随核数扩展
+//写：只锁所在分片；扩容时生成新表后原子发布，删除时槽位换成删除标记
+//回收：基于epoch，读线程在查找期间在自己的槽位中登记当前epoch，被替换的旧表和被删除的记录记下摘除时的epoch，
+//所有正在查找的线程都已登记更新的epoch后才释放；注册失败反复插入、删除也不会使内存持续增长
+class user_table
+{
+public:
+	//单例模式
+	static user_table *GetInstance();
+
+	//查找用户，找到则把密码写入passwd
+	bool find(const char *name, string &passwd);
+	//用户存在且密码一致
+	bool check(const char *name, const char *passwd);
+	//用户不存在时插入，已存在返回false；用于注册时原子地占用用户名
+	bool insert(const char *name, const char *passwd);
+	//删除用户，用于注册写库失败时回滚
+	bool erase(const char *name);
+	//用户总数
+	int size();
+
+private:
+	user_table();
+	~user_table();
+
+	static const int SHARD_BITS = 6;
+	static const int SHARD_NUM = 1 << SHARD_BITS;
+	static const size_t INIT_CAPACITY = 64;
+	static const int MAX_READERS = 256;	//登记epoch的读线程数上限，超出的线程加分片锁查找
+
+	struct entry
+	{
+		size_t hash;
+		string name;
+		string passwd;
+	};
+
+	struct table
+	{
+		size_t mask;
+		atomic<entry *> *slots;
+	};
+
+	struct alignas(64) shard
+	{
+		atomic<table *> tab;
+		locker lock;
+		size_t used;			  //已占用的槽位数(含删除标记)
+		int count;				  //有效用户数
+		vector<pair<uint64_t, table *> > retired;  //被替换的旧表及摘除时的epoch
+		vector<pair<uint64_t, entry *> > removed;  //被删除的记录及摘除时的epoch
+	};
+
+	//读线程登记的epoch，0表示不在查找中；每个线程一个缓存行，互不干扰
+	struct alignas(64) reader
+	{
+		atomic<uint64_t> epoch;
+	};
+	//查找期间登记epoch，构造时取得本线程的槽位，槽位用完时改为加分片锁
+	class read_guard
+	{
+	public:
+		read_guard(user_table *t, shard &sh);
+		~read_guard();
+
+	private:
+		reader *m_reader;
+		shard *m_locked;
+	};
+
+	static size_t hash_of(const char *name, size_t len);
+	shard &shard_of(size_t hash) { return m_shards[hash >> (sizeof(size_t) * 8 - SHARD_BITS)]; }
+	const entry *lookup(shard &sh, size_t hash, const char *name, size_t len);
+	void grow(shard &sh);
+	//持有分片锁时调用：摘除的对象记下当前epoch后推进epoch，再释放已没有线程能访问到的对象
+	uint64_t retire_epoch() { return m_epoch.fetch_add(1, memory_order_seq_cst); }
+	void reclaim(shard &sh);
+
+	entry *tombstone() { return &m_tombstone; }
+
+	shard m_shards[SHARD_NUM];
+	entry m_tombstone;	//删除标记，探测时跳过
+
+	atomic<uint64_t> m_epoch;
+	atomic<int> m_reader_num;
+	reader m_readers[MAX_READERS];
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include <exception>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "user_writer.h"
+
+using namespace std;
+
+static long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+user_writer::user_writer(user_store *store, int close_log, const char *spill_path, int batch_size, int flush_ms, int max_pending)
+	: m_store(store), m_batch_size(batch_size), m_flush_ms(flush_ms), m_max_pending(max_pending),
+	  m_close_log(close_log), m_spill_path(spill_path), m_first_ms(0), m_stop(false), m_stop_ms(0), m_stopped(false)
+{
+	if (batch_size <= 0 || flush_ms <= 0 || max_pending <= 0)
+		throw std::exception();
+	m_pending.reserve(batch_size);
+	if (pthread_create(&m_tid, NULL, worker, this) != 0)
+		throw std::exception();
+}
+
+user_writer::~user_writer()
+{
+	stop();
+}
+
+bool user_writer::append(const char *name, const char *passwd)
+{
+	m_lock.lock();
+	if (m_stop || (int)m_pending.size() >= m_max_pending)
+	{
+		m_lock.unlock();
+		return false;
+	}
+	if (m_pending.empty())
+		m_first_ms = now_ms();
+	m_pending.push_back(make_pair(string(name), string(passwd)));
+	//攒够一批立即唤醒写线程
+	if ((int)m_pending.size() >= m_batch_size)
+		m_cond.signal();
+	m_lock.unlock();
+	return true;
+}
+
+void user_writer::stop(int wait_ms)
+{
+	m_lock.lock();
+	if (m_stopped)
+	{
+		m_lock.unlock();
+		return;
+	}
+	m_stop = true;
+	m_stop_ms = now_ms() + (wait_ms > 0 ? wait_ms : 0);
+	m_stopped = true;
+	m_cond.signal();
+	m_lock.unlock();
+	pthread_join(m_tid, NULL);
+}
+
+int user_writer::pending()
+{
+	m_lock.lock();
+	int n = m_pending.size();
+	m_lock.unlock();
+	return n;
+}
+
+void *user_writer::worker(void *arg)
+{
+	user_writer *writer = (user_writer *)arg;
+	mysql_thread_init();
+	writer->run();
+	mysql_thread_end();
+	return NULL;
+}
+
+void user_writer::run()
+{
+	vector<pair<string, string> > rows;
+	int failures = 0;
+	while (true)
+	{
+		m_lock.lock();
+		//等到攒够一批、最早一条超时或停止
+		while (!m_stop)
+		{
+			long long now = now_ms();
+			long long deadline = now + m_flush_ms;
+			if (!m_pending.empty())
+			{
+				if ((int)m_pending.size() >= m_batch_size && failures == 0)
+					break;
+				//连续失败时按次数退避，避免数据库不可用时空转
+				deadline = m_first_ms + (long long)m_flush_ms * (failures + 1);
+				if (now >= deadline)
+					break;
+			}
+			struct timespec t;
+			t.tv_sec = deadline / 1000;
+			t.tv_nsec = (deadline % 1000) * 1000000L;
+			m_cond.timewait(m_lock.get(), t);
+		}
+		bool stop = m_stop;
+		rows.swap(m_pending);
+		m_first_ms = now_ms();
+		m_lock.unlock();
+
+		if (!rows.empty())
+		{
+			int done = flush(rows);
+			rows.erase(rows.begin(), rows.begin() + done);
+			failures = rows.empty() ? 0 : (failures < 10 ? failures + 1 : failures);
+		}
+
+		if (!rows.empty())
+		{
+			//写失败的记录放回队首，下次重试
+			m_lock.lock();
+			rows.insert(rows.end(), m_pending.begin(), m_pending.end());
+			m_pending.swap(rows);
+			m_lock.unlock();
+			rows.clear();
+		}
+
+		if (stop)
+		{
+			//停止后append不再入队，队列只由本线程访问；截止时刻之前按失败次数退避重试
+			while (!m_pending.empty())
+			{
+				long long left = m_stop_ms - now_ms();
+				if (left <= 0)
+					break;
+				long long wait = (long long)m_flush_ms * (failures + 1);
+				usleep((wait < left ? wait : left) * 1000);
+				m_pending.erase(m_pending.begin(), m_pending.begin() + flush(m_pending));
+				failures = failures < 10 ? failures + 1 : failures;
+			}
+			//仍未写入的记录保存到溢出文件，下次启动时写回
+			if (!m_pending.empty())
+				spill(m_pending);
+			return;
+		}
+	}
+}
+
+int user_writer::flush(vector<pair<string, string> > &rows)
+{
+	int done = m_store->insert_batch(rows);
+	//批量写入在某一行失败，逐行写入余下的记录以区分该行的原因，只有存储不可用时才停下重试
+	for (; done < (int)rows.size(); ++done)
+	{
+		const char *name = rows[done].first.c_str();
+		user_store::INSERT_RESULT ret = m_store->insert(name, rows[done].second.c_str());
+		if (user_store::INSERT_ERROR == ret)
+			break;
+		if (user_store::INSERT_INVALID == ret)
+		{
+			LOG_ERROR("user %s rejected by %s store, dropped", name, m_store->name());
+			user_table::GetInstance()->erase(name);
+		}
+		else if (user_store::INSERT_EXISTS == ret)
+		{
+			//可能由其他实例注册，密码以存储中的为准，用存储中的数据覆盖内存表
+			//用户已被告知注册成功，这里无法再通知，以错误日志记录
+			LOG_ERROR("user %s already in %s store, registration discarded", name, m_store->name());
+			if (!m_store->refresh(name, user_table::GetInstance()))
+				user_table::GetInstance()->erase(name);
+		}
+	}
+	return done;
+}
+
+void user_writer::spill(const vector<pair<string, string> > &rows)
+{
+	FILE *fp = fopen(m_spill_path.c_str(), "ae");
+	if (fp == NULL)
+	{
+		for (size_t i = 0; i < rows.size(); ++i)
+			LOG_ERROR("user not persisted: %s", rows[i].first.c_str());
+		return;
+	}
+	//每行一条：用户名\t密码
+	for (size_t i = 0; i < rows.size(); ++i)
+	{
+		const string &name = rows[i].first;
+		const string &passwd = rows[i].second;
+		if (name.find_first_of("\t\n") != string::npos || passwd.find_first_of("\t\n") != string::npos)
+		{
+			LOG_ERROR("user not persisted: %s", name.c_str());
+			continue;
+		}
+		fprintf(fp, "%s\t%s\n", name.c_str(), passwd.c_str());
+	}
+	fflush(fp);
+	fsync(fileno(fp));
+	fclose(fp);
+	LOG_ERROR("%d users not persisted, saved to %s", (int)rows.size(), m_spill_path.c_str());
+}
+
+int user_writer::replay(user_store *store, const char *path, int close_log)
+{
+	int m_close_log = close_log;	//供LOG宏使用
+	FILE *fp = fopen(path, "re");
+	if (fp == NULL)
+		return 0;
+
+	int done = 0;
+	vector<pair<string, string> > keep;
+	char line[256];
+	while (fgets(line, sizeof(line), fp))
+	{
+		char *tab = strchr(line, '\t');
+		char *end = strchr(line, '\n');
+		if (tab == NULL || end == NULL || end < tab)
+			continue;
+		*tab = '\0';
+		*end = '\0';
+		const char *name = line;
+		const char *passwd = tab + 1;
+		user_store::INSERT_RESULT ret = store->insert(name, passwd);
+		if (user_store::INSERT_OK == ret)
+		{
+			user_table::GetInstance()->insert(name, passwd);
+			++done;
+		}
+		else if (user_store::INSERT_ERROR == ret)
+			keep.push_back(make_pair(string(name), string(passwd)));
+		else
+			LOG_ERROR("spilled user %s not restored: %s", name, user_store::INSERT_EXISTS == ret ? "name taken" : "rejected");
+	}
+	fclose(fp);
+
+	//存储仍不可用的记录写回文件，下次启动再试
+	if (keep.empty())
+		unlink(path);
+	else
+	{
+		string tmp = string(path) + ".tmp";
+		fp = fopen(tmp.c_str(), "we");
+		if (fp)
+		{
+			for (size_t i = 0; i < keep.size(); ++i)
+				fprintf(fp, "%s\t%s\n", keep[i].first.c_str(), keep[i].second.c_str());
+			fflush(fp);
+			fsync(fileno(fp));
+			fclose(fp);
+			rename(tmp.c_str(), path);
+		}
+	}
+	LOG_INFO("replayed %d spilled users from %s, %d left", done, path, (int)keep.size());
+	return done;
+}
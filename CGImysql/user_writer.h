@@ -0,0 +1,61 @@
+#ifndef _USER_WRITER_
+#define _USER_WRITER_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <pthread.h>
+#include "../lock/locker.h"
+#include "user_store.h"
+
+using namespace std;
+
+//注册写库的后写(write-behind)阶段
+//注册时用户已写入内存表并立即返回成功，这里只负责把新用户合并成批量写入存储后端
+//攒够batch_size条或距最早一条超过flush_ms毫秒即刷新；整批失败时逐行写入，
+//存储暂不可用的记录保留到下次重试，被存储拒绝的记录丢弃并从内存表中删除
+//注意：已告知注册成功的用户之后才可能被拒绝或发现用户名已存在(如由其他实例注册)，只能记录日志
+//stop()在给定时间内退避重试，仍未写入的记录追加到溢出文件，下次启动时由replay写回存储
+class user_writer
+{
+public:
+	user_writer(user_store *store, int close_log, const char *spill_path, int batch_size = 64, int flush_ms = 200, int max_pending = 100000);
+	~user_writer();
+
+	//加入待写队列，队列满返回false
+	bool append(const char *name, const char *passwd);
+	//停止接收新记录，最多用wait_ms毫秒刷完剩余记录，之后停止后台线程
+	void stop(int wait_ms = 0);
+	//待写入的记录数
+	int pending();
+
+	//启动时把上次溢出的记录写入存储并补入内存表，存储仍不可用的留在文件中，返回写入的条数
+	static int replay(user_store *store, const char *path, int close_log);
+
+private:
+	static void *worker(void *arg);
+	void run();
+	//写入一批，返回从头起已处理(写入、已存在或丢弃)的条数，其余需要重试
+	int flush(vector<pair<string, string> > &rows);
+	//把记录追加到溢出文件
+	void spill(const vector<pair<string, string> > &rows);
+
+private:
+	user_store *m_store;
+	int m_batch_size;
+	int m_flush_ms;
+	int m_max_pending;
+	int m_close_log;
+	string m_spill_path;
+
+	vector<pair<string, string> > m_pending;
+	long long m_first_ms;	//队列中最早一条的加入时间
+	bool m_stop;
+	long long m_stop_ms;	//停止时重试的截止时刻
+	bool m_stopped;
+	locker m_lock;
+	cond m_cond;
+	pthread_t m_tid;
+};
+
+#endif
@@ -22,6 +22,18 @@ Config::Config(){
     //数据库连接池数量,默认8
     sql_num = 8;
 
+    //数据库连接池最小连接数,默认2,其余按需建立
+    sql_min_num = 2;
+
+    //注册后写刷新间隔,默认0,关闭后写,注册在落库之后才返回成功
+    user_flush_ms = 0;
+
+    //用户存储后端,默认MySQL
+    store_backend = 0;
+
+    //登录会话有效期,默认30分钟
+    session_ttl = 1800;
+
     //线程池内的线程数量,默认8
     thread_num = 8;
 
@@ -30,11 +42,46 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //访问日志,默认关闭
+    access_sample = 0;
+
+    //慢请求阈值,默认100ms
+    access_slow_ms = 100;
+
+    //请求抓包,默认关闭
+    capture_mb = 0;
+
+    //事件引擎,默认epoll
+    event_engine = 0;
+
+    //监听队列长度,默认1024
+    backlog = 1024;
+
+    //延迟accept,默认不使用
+    defer_accept = 0;
+
+    //过载控制,默认关闭
+    overload_ms = 0;
+    ip_conn_limit = 0;
+    ip_rate = 0;
+
+    //停机排空,默认最多等待10秒
+    drain_timeout = 10;
+
+    //CPU绑定,默认不绑定
+    cpus = "";
+
+    //慢速客户端时限,默认请求头10秒、请求体每秒至少1024字节、发送和空闲15秒
+    header_timeout = 10;
+    body_rate = 1024;
+    write_timeout = 15;
+    idle_timeout = 15;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:n:w:b:e:t:c:a:A:L:r:E:B:D:Q:I:R:G:P:H:M:W:K:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -64,6 +111,26 @@ void Config::parse_arg(int argc, char*argv[]){
             sql_num = atoi(optarg);
             break;
         }
+        case 'n':
+        {
+            sql_min_num = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            user_flush_ms = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            store_backend = atoi(optarg);
+            break;
+        }
+        case 'e':
+        {
+            session_ttl = atoi(optarg);
+            break;
+        }
         case 't':
         {
             thread_num = atoi(optarg);
@@ -79,6 +146,81 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'A':
+        {
+            access_sample = atoi(optarg);
+            break;
+        }
+        case 'L':
+        {
+            access_slow_ms = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            capture_mb = atoi(optarg);
+            break;
+        }
+        case 'E':
+        {
+            event_engine = atoi(optarg);
+            break;
+        }
+        case 'B':
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case 'D':
+        {
+            defer_accept = atoi(optarg);
+            break;
+        }
+        case 'Q':
+        {
+            overload_ms = atoi(optarg);
+            break;
+        }
+        case 'I':
+        {
+            ip_conn_limit = atoi(optarg);
+            break;
+        }
+        case 'R':
+        {
+            ip_rate = atoi(optarg);
+            break;
+        }
+        case 'G':
+        {
+            drain_timeout = atoi(optarg);
+            break;
+        }
+        case 'P':
+        {
+            cpus = optarg;
+            break;
+        }
+        case 'H':
+        {
+            header_timeout = atoi(optarg);
+            break;
+        }
+        case 'M':
+        {
+            body_rate = atoi(optarg);
+            break;
+        }
+        case 'W':
+        {
+            write_timeout = atoi(optarg);
+            break;
+        }
+        case 'K':
+        {
+            idle_timeout = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
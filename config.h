@@ -34,6 +34,18 @@ public:
     //数据库连接池数量
     int sql_num;
 
+    //数据库连接池最小连接数
+    int sql_min_num;
+
+    //注册后写刷新间隔(毫秒)，0为关闭后写
+    int user_flush_ms;
+
+    //用户存储后端，0为MySQL，1为本地文件，2为内存
+    int store_backend;
+
+    //登录会话有效期(秒)，0为不下发会话cookie
+    int session_ttl;
+
     //线程池内的线程数量
     int thread_num;
 
@@ -42,6 +54,41 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //访问日志采样率，每N条记录一条，0为关闭
+    int access_sample;
+
+    //慢请求阈值(毫秒)，超过则必定记录访问日志
+    int access_slow_ms;
+
+    //请求抓包文件大小上限(MB)，0为关闭
+    int capture_mb;
+
+    //事件引擎，0为epoll，1为io_uring
+    int event_engine;
+
+    //监听队列长度
+    int backlog;
+
+    //TCP_DEFER_ACCEPT秒数，0为不使用
+    int defer_accept;
+
+    //过载控制：排队时延目标(毫秒)、单ip并发连接上限、单ip每秒请求数，0为不限制
+    int overload_ms;
+    int ip_conn_limit;
+    int ip_rate;
+
+    //停机排空时限(秒)，0为收到SIGTERM立即退出
+    int drain_timeout;
+
+    //绑定的CPU列表，如"0,2-5"，第一个给主循环，其余轮流分给工作线程，空为不绑定
+    string cpus;
+
+    //各阶段时限：收齐请求头(秒)、请求体最低速率(字节/秒)、发送无进展(秒)、长连接空闲(秒)
+    int header_timeout;
+    int body_rate;
+    int write_timeout;
+    int idle_timeout;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "event_engine.h"
+
+event_engine *event_engine::create(int type, int max_fd, unsigned recv_size)
+{
+	if (ENGINE_URING == type)
+	{
+		uring_engine *uring = new uring_engine(max_fd, recv_size);
+		if (uring->init())
+			return uring;
+		delete uring;
+	}
+	epoll_engine *ep = new epoll_engine();
+	if (ep->init())
+		return ep;
+	delete ep;
+	return NULL;
+}
+
+epoll_engine::epoll_engine() : m_epollfd(-1)
+{
+}
+
+epoll_engine::~epoll_engine()
+{
+	if (m_epollfd >= 0)
+		close(m_epollfd);
+}
+
+bool epoll_engine::init()
+{
+	m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+	return m_epollfd >= 0;
+}
+
+void epoll_engine::add(int fd, uint32_t events)
+{
+	epoll_event event;
+	event.data.fd = fd;
+	event.events = events;
+	epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void epoll_engine::mod(int fd, uint32_t events)
+{
+	epoll_event event;
+	event.data.fd = fd;
+	event.events = events;
+	epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void epoll_engine::del(int fd)
+{
+	epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+}
+
+int epoll_engine::wait(epoll_event *events, int max_events, int timeout_ms)
+{
+	return epoll_wait(m_epollfd, events, max_events, timeout_ms);
+}
+
+//取消请求自身的完成事件使用的user_data
+static const uint64_t CANCEL_TAG = ~0ULL;
+//accept请求的user_data带此位，低32位为槽位下标
+static const uint64_t ACCEPT_BIT = 1ULL << 63;
+//poll关注的事件位，触发方式由请求类型表达
+static const uint32_t POLL_MASK = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLPRI;
+//同时等待的accept请求数
+static const unsigned ACCEPT_SLOTS = 16;
+//接收缓冲区个数，必须是2的幂；只在数据到达后才占用，取出即归还
+static const unsigned RECV_BUFS = 1024;
+static const uint16_t RECV_BGID = 0;
+
+//user_data：高32位为代数(最高位留给ACCEPT_BIT)，低32位为fd或槽位
+static uint64_t make_tag(uint32_t gen, uint32_t id)
+{
+	return ((uint64_t)(gen & 0x7fffffff) << 32) | id;
+}
+
+static uint32_t tag_gen(uint64_t tag)
+{
+	return (uint32_t)(tag >> 32) & 0x7fffffff;
+}
+
+uring_engine::uring_engine(int max_fd, unsigned recv_size)
+	: m_ring_fd(-1), m_fds(max_fd), m_listen_fd(-1), m_listen_gen(0), m_slots(ACCEPT_SLOTS),
+	  m_recv_size(recv_size), m_buf_ring(NULL), m_bufs(NULL), m_buf_tail(0),
+	  m_sq_ring(MAP_FAILED), m_sq_ring_size(0), m_cq_ring(MAP_FAILED), m_cq_ring_size(0), m_sqes(NULL), m_sqes_size(0)
+{
+	for (size_t i = 0; i < m_fds.size(); ++i)
+	{
+		m_fds[i].gen = 0;
+		m_fds[i].events = 0;
+		m_fds[i].armed = false;
+		m_fds[i].recv = false;
+		m_fds[i].poll_once = false;
+		m_fds[i].recv_len = 0;
+		m_fds[i].done = false;
+		m_fds[i].res = 0;
+		m_fds[i].bid = 0;
+	}
+	for (size_t i = 0; i < m_slots.size(); ++i)
+		m_slots[i].armed = false;
+}
+
+uring_engine::~uring_engine()
+{
+	//先关闭io_uring，内核取消仍在等待的请求后再释放缓冲区
+	if (m_ring_fd >= 0)
+		close(m_ring_fd);
+	for (size_t i = 0; i < m_accepted.size(); ++i)
+		close(m_accepted[i].first);
+	if (m_sqes)
+		munmap(m_sqes, m_sqes_size);
+	if (m_cq_ring != MAP_FAILED)
+		munmap(m_cq_ring, m_cq_ring_size);
+	if (m_sq_ring != MAP_FAILED)
+		munmap(m_sq_ring, m_sq_ring_size);
+	if (m_buf_ring)
+		munmap(m_buf_ring, RECV_BUFS * sizeof(io_uring_buf));
+	delete[] m_bufs;
+}
+
+bool uring_engine::init(unsigned entries)
+{
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	m_ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (m_ring_fd < 0)
+		return false;
+	//multishot poll需要5.13及以上内核，没有单独的特性位，以同版本加入的RSRC_TAGS判断
+	if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_RSRC_TAGS))
+		return false;
+
+	m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+	m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+	m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+	if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+		return false;
+	m_sqes = (io_uring_sqe *)sqes;
+
+	char *sq = (char *)m_sq_ring;
+	m_sq_head = (unsigned *)(sq + p.sq_off.head);
+	m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	m_sq_array = (unsigned *)(sq + p.sq_off.array);
+	m_sq_entries = p.sq_entries;
+	char *cq = (char *)m_cq_ring;
+	m_cq_head = (unsigned *)(cq + p.cq_off.head);
+	m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	//缓冲区环需要5.19及以上内核，注册失败时连接仍以poll等待可读
+	if (!setup_bufs())
+	{
+		if (m_buf_ring)
+			munmap(m_buf_ring, RECV_BUFS * sizeof(io_uring_buf));
+		m_buf_ring = NULL;
+	}
+
+	//wait只在创建引擎的主循环线程中调用
+	m_loop_thread = pthread_self();
+	return true;
+}
+
+bool uring_engine::setup_bufs()
+{
+	if (0 == m_recv_size)
+		return false;
+	void *ring = mmap(NULL, RECV_BUFS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED)
+		return false;
+	m_buf_ring = (io_uring_buf_ring *)ring;
+
+	io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)ring;
+	reg.ring_entries = RECV_BUFS;
+	reg.bgid = RECV_BGID;
+	if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return false;
+
+	m_bufs = new char[RECV_BUFS * m_recv_size];
+	for (unsigned i = 0; i < RECV_BUFS; ++i)
+		recycle(i);
+	return true;
+}
+
+//缓冲区放回环中供内核再次选择，需持有m_lock(初始化时除外)
+void uring_engine::recycle(uint16_t bid)
+{
+	//C++下io_uring_buf_ring::bufs前有空结构体占位，不能直接用，环就是io_uring_buf数组，tail与第0项的resv重叠
+	io_uring_buf *buf = (io_uring_buf *)m_buf_ring + (m_buf_tail & (RECV_BUFS - 1));
+	buf->addr = (uint64_t)(m_bufs + (size_t)bid * m_recv_size);
+	buf->len = m_recv_size;
+	buf->bid = bid;
+	++m_buf_tail;
+	__atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+int uring_engine::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+unsigned uring_engine::pending()
+{
+	return *m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+}
+
+//提交队列满时先提交已有的项，仍然满则返回NULL
+io_uring_sqe *uring_engine::get_sqe(uint8_t opcode, int fd, uint64_t user_data)
+{
+	if (pending() >= m_sq_entries)
+	{
+		enter(pending(), 0, 0, NULL, 0);
+		if (pending() >= m_sq_entries)
+			return NULL;
+	}
+	io_uring_sqe *sqe = &m_sqes[*m_sq_tail & *m_sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	return sqe;
+}
+
+void uring_engine::publish()
+{
+	unsigned tail = *m_sq_tail;
+	unsigned idx = tail & *m_sq_mask;
+	m_sq_array[idx] = idx;
+	__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+//按当前事件位提交接收或poll，需持有m_lock
+void uring_engine::arm(int fd)
+{
+	fd_state &st = m_fds[fd];
+	uint64_t user_data = make_tag(st.gen, fd);
+	//单次等待可读的连接直接接收，数据写入内核选择的缓冲区
+	st.recv = m_buf_ring && (st.events & EPOLLONESHOT) && (st.events & EPOLLIN) && !(st.events & EPOLLOUT) &&
+			  st.recv_len > 0 && !st.poll_once;
+	if (st.recv)
+	{
+		io_uring_sqe *sqe = get_sqe(IORING_OP_RECV, fd, user_data);
+		st.armed = sqe != NULL;
+		if (!sqe)
+			return;
+		sqe->len = st.recv_len < m_recv_size ? st.recv_len : m_recv_size;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = RECV_BGID;
+		publish();
+		return;
+	}
+
+	bool multishot = (st.events & EPOLLET) && !(st.events & EPOLLONESHOT);
+	io_uring_sqe *sqe = get_sqe(IORING_OP_POLL_ADD, fd, user_data);
+	st.armed = sqe != NULL;
+	if (!sqe)
+		return;
+	sqe->poll32_events = st.events & POLL_MASK;
+	sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+	publish();
+}
+
+//撤销仍在等待的请求并归还未取出的数据，之后到达的旧完成事件因gen不同被丢弃，需持有m_lock
+void uring_engine::cancel(int fd)
+{
+	fd_state &st = m_fds[fd];
+	if (st.armed)
+	{
+		io_uring_sqe *sqe = get_sqe(IORING_OP_ASYNC_CANCEL, -1, CANCEL_TAG);
+		if (sqe)
+		{
+			sqe->addr = make_tag(st.gen, fd);
+			publish();
+		}
+	}
+	if (st.done && st.res > 0)
+		recycle(st.bid);
+	st.done = false;
+	st.armed = false;
+	st.poll_once = false;
+	++st.gen;
+}
+
+//工作线程的修改立即提交；主循环线程的修改留到下一次wait一起提交，需持有m_lock
+void uring_engine::submit_if_remote()
+{
+	if (!pthread_equal(pthread_self(), m_loop_thread) && pending() > 0)
+		enter(pending(), 0, 0, NULL, 0);
+}
+
+void uring_engine::add(int fd, uint32_t events)
+{
+	mod_recv(fd, events, m_recv_size);
+}
+
+void uring_engine::mod(int fd, uint32_t events)
+{
+	mod_recv(fd, events, m_recv_size);
+}
+
+void uring_engine::mod_recv(int fd, uint32_t events, unsigned len)
+{
+	if (fd < 0 || fd >= (int)m_fds.size())
+		return;
+	m_lock.lock();
+	cancel(fd);
+	m_fds[fd].events = events;
+	m_fds[fd].recv_len = len;
+	arm(fd);
+	submit_if_remote();
+	m_lock.unlock();
+}
+
+void uring_engine::del(int fd)
+{
+	if (fd < 0 || fd >= (int)m_fds.size())
+		return;
+	m_lock.lock();
+	if (fd == m_listen_fd)
+	{
+		//撤销全部accept并立即提交，之后不会再有新的连接
+		for (unsigned i = 0; i < m_slots.size(); ++i)
+		{
+			if (!m_slots[i].armed)
+				continue;
+			io_uring_sqe *sqe = get_sqe(IORING_OP_ASYNC_CANCEL, -1, CANCEL_TAG);
+			if (sqe)
+			{
+				sqe->addr = ACCEPT_BIT | make_tag(m_listen_gen, i);
+				publish();
+			}
+			m_slots[i].armed = false;
+		}
+		enter(pending(), 0, 0, NULL, 0);
+		++m_listen_gen;
+		m_listen_fd = -1;
+		//撤销生效前已完成、还在完成队列中的accept也是客户的连接，与未取出的连接一起由take_accept取出
+		unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+		for (unsigned head = *m_cq_head; head != tail; ++head)
+		{
+			io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+			if (cqe->user_data == CANCEL_TAG || !(cqe->user_data & ACCEPT_BIT))
+				continue;
+			if (cqe->res >= 0)
+				m_accepted.push_back(make_pair(cqe->res, m_slots[(uint32_t)cqe->user_data].addr));
+			cqe->user_data = CANCEL_TAG;
+		}
+	}
+	cancel(fd);
+	m_fds[fd].events = 0;
+	submit_if_remote();
+	m_lock.unlock();
+}
+
+//槽位的地址缓冲区在请求完成前由内核写入，需持有m_lock
+void uring_engine::arm_accept(unsigned slot)
+{
+	accept_slot &s = m_slots[slot];
+	s.addrlen = sizeof(s.addr);
+	io_uring_sqe *sqe = get_sqe(IORING_OP_ACCEPT, m_listen_fd, ACCEPT_BIT | make_tag(m_listen_gen, slot));
+	s.armed = sqe != NULL;
+	if (!sqe)
+		return;
+	sqe->addr = (uint64_t)&s.addr;
+	sqe->addr2 = (uint64_t)&s.addrlen;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	publish();
+}
+
+//multishot accept的多个完成共用一个地址缓冲区，取不到各自的对端地址，因此用一组单次accept，
+//完成后的重新提交与下一次等待合并，不增加系统调用
+bool uring_engine::add_listener(int fd)
+{
+	if (m_listen_fd >= 0 || fd < 0 || fd >= (int)m_fds.size())
+		return false;
+	m_lock.lock();
+	m_listen_fd = fd;
+	for (unsigned i = 0; i < m_slots.size(); ++i)
+		arm_accept(i);
+	m_lock.unlock();
+	return true;
+}
+
+int uring_engine::take_accept(sockaddr_in *addr)
+{
+	if (m_accepted.empty())
+		return -1;
+	int connfd = m_accepted.front().first;
+	*addr = m_accepted.front().second;
+	m_accepted.pop_front();
+	return connfd;
+}
+
+bool uring_engine::take_recv(int fd, char *buf, unsigned len, int &bytes)
+{
+	if (fd < 0 || fd >= (int)m_fds.size())
+		return false;
+	m_lock.lock();
+	fd_state &st = m_fds[fd];
+	bool done = st.done;
+	if (done)
+	{
+		st.done = false;
+		if (st.res > 0)
+		{
+			//提交时已按len限制了接收长度
+			bytes = (unsigned)st.res < len ? st.res : (int)len;
+			memcpy(buf, m_bufs + (size_t)st.bid * m_recv_size, bytes);
+			recycle(st.bid);
+		}
+		else if (0 == st.res)
+			bytes = 0;
+		else
+		{
+			bytes = -1;
+			errno = -st.res;
+		}
+	}
+	m_lock.unlock();
+	return done;
+}
+
+int uring_engine::wait(epoll_event *events, int max_events, int timeout_ms)
+{
+	m_lock.lock();
+	unsigned to_submit = pending();
+	bool ready = *m_cq_head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+	m_lock.unlock();
+
+	//提交与等待合并为一次系统调用，已有完成事件时不等待
+	if (!ready && timeout_ms != 0)
+	{
+		int ret;
+		if (timeout_ms < 0)
+			ret = enter(to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		else
+		{
+			__kernel_timespec ts;
+			ts.tv_sec = timeout_ms / 1000;
+			ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+			io_uring_getevents_arg arg;
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = (uint64_t)&ts;
+			ret = enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		}
+		if (ret < 0 && errno != ETIME)
+			return -1;
+	}
+	else if (to_submit > 0)
+	{
+		enter(to_submit, 0, 0, NULL, 0);
+	}
+
+	m_lock.lock();
+	int number = 0;
+	unsigned head = *m_cq_head;
+	unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && number < max_events)
+	{
+		io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+		++head;
+		if (cqe->user_data == CANCEL_TAG)
+			continue;
+		uint32_t gen = tag_gen(cqe->user_data);
+		uint32_t id = (uint32_t)cqe->user_data;
+
+		if (cqe->user_data & ACCEPT_BIT)
+		{
+			//监听套接字已撤销，撤销前完成的连接直接关闭
+			if (gen != (m_listen_gen & 0x7fffffff) || m_listen_fd < 0)
+			{
+				if (cqe->res >= 0)
+					close(cqe->res);
+				continue;
+			}
+			if (cqe->res >= 0)
+			{
+				//一批中只返回一个监听事件，由主循环一次取完
+				if (m_accepted.empty())
+				{
+					events[number].events = EPOLLIN;
+					events[number].data.fd = m_listen_fd;
+					++number;
+				}
+				m_accepted.push_back(make_pair(cqe->res, m_slots[id].addr));
+			}
+			arm_accept(id);
+			continue;
+		}
+
+		int fd = (int)id;
+		bool current = fd < (int)m_fds.size() && (m_fds[fd].gen & 0x7fffffff) == gen;
+		if (!current)
+		{
+			//撤销前已完成的接收，缓冲区放回环中
+			if (cqe->flags & IORING_CQE_F_BUFFER)
+				recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			continue;
+		}
+
+		fd_state &st = m_fds[fd];
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			st.armed = false;
+		if (st.recv)
+		{
+			//缓冲区用尽，改为poll，可读后由调用方自行recv
+			if (cqe->res == -ENOBUFS)
+			{
+				st.poll_once = true;
+				arm(fd);
+				continue;
+			}
+			st.done = true;
+			st.res = cqe->res;
+			st.bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			events[number].events = EPOLLIN;
+			events[number].data.fd = fd;
+			++number;
+			continue;
+		}
+		if (cqe->res < 0)
+			continue;
+		events[number].events = cqe->res;
+		events[number].data.fd = fd;
+		++number;
+		//LT的单次poll，以及被内核终止的multishot，重新提交
+		if (!st.armed && !(st.events & EPOLLONESHOT))
+			arm(fd);
+	}
+	__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+	m_lock.unlock();
+	return number;
+}
@@ -0,0 +1,164 @@
+#ifndef _EVENT_ENGINE_
+#define _EVENT_ENGINE_
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//事件引擎，主循环与http连接只通过该接口注册、修改、删除和等待就绪事件
+//事件位沿用epoll的定义(EPOLLIN/EPOLLOUT/EPOLLRDHUP/EPOLLET/EPOLLONESHOT)，wait返回epoll_event
+//add/mod/del可在任意线程调用，wait只在主循环线程调用
+class event_engine
+{
+public:
+	enum ENGINE
+	{
+		ENGINE_EPOLL = 0,
+		ENGINE_URING
+	};
+
+	virtual ~event_engine() {}
+
+	virtual void add(int fd, uint32_t events) = 0;
+	virtual void mod(int fd, uint32_t events) = 0;
+	virtual void del(int fd) = 0;
+	//等待就绪事件，timeout_ms为-1时一直等待，被信号中断返回-1且errno为EINTR
+	virtual int wait(epoll_event *events, int max_events, int timeout_ms) = 0;
+	virtual const char *name() const = 0;
+
+	//完成式接口，epoll不支持：add_listener返回false、take_*取不到结果时，调用方按就绪事件自行accept/recv
+	//监听套接字由引擎在内核中accept，wait对监听套接字返回EPOLLIN后由take_accept逐个取出连接，取完返回-1
+	//del监听套接字之前已accept的连接仍由take_accept取出；add_listener、take_accept与监听套接字的del只在主循环线程调用
+	virtual bool add_listener(int fd) { return false; }
+	virtual int take_accept(sockaddr_in *addr) { return -1; }
+	//EPOLLONESHOT的连接等待可读时直接提交接收，最多读len字节，wait返回EPOLLIN后由take_recv取出
+	virtual void mod_recv(int fd, uint32_t events, unsigned len) { mod(fd, events); }
+	//没有已完成的接收时返回false；bytes为读到的字节数，0表示对端关闭，-1表示出错并设置errno
+	virtual bool take_recv(int fd, char *buf, unsigned len, int &bytes) { return false; }
+
+	//按类型创建，io_uring不可用时退回epoll；recv_size为一次接收的最大字节数
+	static event_engine *create(int type, int max_fd, unsigned recv_size);
+};
+
+class epoll_engine : public event_engine
+{
+public:
+	epoll_engine();
+	~epoll_engine();
+	bool init();
+
+	void add(int fd, uint32_t events);
+	void mod(int fd, uint32_t events);
+	void del(int fd);
+	int wait(epoll_event *events, int max_events, int timeout_ms);
+	const char *name() const { return "epoll"; }
+
+private:
+	int m_epollfd;
+};
+
+//基于io_uring的引擎，不依赖liburing，直接使用io_uring_setup/io_uring_enter
+//监听套接字：保持若干个IORING_OP_ACCEPT，每个带自己的地址缓冲区，完成后重新提交
+//等待可读的EPOLLONESHOT连接：IORING_OP_RECV，由内核从注册的缓冲区环(provided buffer ring)中选择缓冲区，
+//不占用连接自己的缓冲区，关闭连接时不必等待内核释放；缓冲区用尽时该次改为poll
+//其他情况仍是IORING_OP_POLL_ADD：EPOLLONESHOT为单次poll；ET为multishot poll；LT为单次poll并在完成后自动重新提交
+//主循环线程的修改只写入提交队列，与下一次等待合并为一次io_uring_enter；其他线程的修改立即提交
+//一次等待收割全部完成事件
+class uring_engine : public event_engine
+{
+public:
+	uring_engine(int max_fd, unsigned recv_size);
+	~uring_engine();
+	bool init(unsigned entries = 4096);
+
+	void add(int fd, uint32_t events);
+	void mod(int fd, uint32_t events);
+	void del(int fd);
+	int wait(epoll_event *events, int max_events, int timeout_ms);
+	const char *name() const { return "io_uring"; }
+
+	bool add_listener(int fd);
+	int take_accept(sockaddr_in *addr);
+	void mod_recv(int fd, uint32_t events, unsigned len);
+	bool take_recv(int fd, char *buf, unsigned len, int &bytes);
+
+private:
+	//每个fd当前请求的状态，gen随每次修改递增，过期的完成事件按gen丢弃
+	struct fd_state
+	{
+		uint32_t gen;
+		uint32_t events;
+		bool armed;
+		bool recv;          //当前请求是接收而不是poll
+		bool poll_once;     //缓冲区用尽，本次等待改为poll
+		unsigned recv_len;
+		bool done;          //接收已完成、数据尚未取出
+		int res;
+		uint16_t bid;
+	};
+	//监听套接字上的一个accept请求
+	struct accept_slot
+	{
+		sockaddr_in addr;
+		socklen_t addrlen;
+		bool armed;
+	};
+
+	void arm(int fd);
+	void cancel(int fd);
+	void arm_accept(unsigned slot);
+	void recycle(uint16_t bid);
+	bool setup_bufs();
+	//取一个提交项并填好公共字段，其余字段由调用方填写后publish，需持有m_lock
+	io_uring_sqe *get_sqe(uint8_t opcode, int fd, uint64_t user_data);
+	void publish();
+	//已写入提交队列、尚未被内核取走的项数
+	unsigned pending();
+	void submit_if_remote();
+	int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz);
+
+	int m_ring_fd;
+	pthread_t m_loop_thread;
+	locker m_lock;
+	vector<fd_state> m_fds;
+
+	//监听套接字，已accept、尚未取出的连接
+	int m_listen_fd;
+	uint32_t m_listen_gen;
+	vector<accept_slot> m_slots;
+	deque<pair<int, sockaddr_in> > m_accepted;
+
+	//接收缓冲区环，不支持时为NULL
+	unsigned m_recv_size;
+	io_uring_buf_ring *m_buf_ring;
+	char *m_bufs;
+	uint16_t m_buf_tail;
+
+	//提交队列
+	unsigned *m_sq_head;
+	unsigned *m_sq_tail;
+	unsigned *m_sq_mask;
+	unsigned *m_sq_array;
+	unsigned m_sq_entries;
+	//完成队列
+	unsigned *m_cq_head;
+	unsigned *m_cq_tail;
+	unsigned *m_cq_mask;
+	io_uring_cqe *m_cqes;
+
+	void *m_sq_ring;
+	size_t m_sq_ring_size;
+	void *m_cq_ring;
+	size_t m_cq_ring_size;
+	io_uring_sqe *m_sqes;
+	size_t m_sqes_size;
+};
+
+#endif
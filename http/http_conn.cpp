@@ -1,6 +1,5 @@
 #include "http_conn.h"
 
-#include <mysql/mysql.h>
 #include <fstream>
 
 //定义http响应的一些状态信息
@@ -13,95 +12,44 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+//与METHOD枚举顺序一致
+const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
 
-locker m_lock;
-map<string, string> users;
-
-void http_conn::initmysql_result(connection_pool *connPool)
-{
-    //先从连接池中取一个连接
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    //在user表中检索username，passwd数据，浏览器端输入
-    if (mysql_query(mysql, "SELECT username,passwd FROM user"))
-    {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
-    }
-
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result))
-    {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
-    }
-}
-
-//对文件描述符设置非阻塞
-int setnonblocking(int fd)
-{
-    //获取当前文件描述符的状态
-    int old_option = fcntl(fd, F_GETFL);
-    //将文件描述符设置为非阻塞
-    int new_option = old_option | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_option);
-    return old_option;
-}
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
+void addfd(event_engine *engine, int fd, bool one_shot, int TRIGMode)
 {
-    epoll_event event;
-    //新创建的event事件与文件描述符fd相关联起来
-    event.data.fd = fd;
-
+    uint32_t events;
     if (1 == TRIGMode)
-        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        events = EPOLLIN | EPOLLET | EPOLLRDHUP;
     else
-        event.events = EPOLLIN | EPOLLRDHUP;
+        events = EPOLLIN | EPOLLRDHUP;
 
     if (one_shot)
-        event.events |= EPOLLONESHOT;
-    //将该epollevent事件添加到epoll中
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    //设为非阻塞
-    setnonblocking(fd);
+        events |= EPOLLONESHOT;
+    //将该事件添加到事件引擎中，连接由accept4创建时已是非阻塞
+    engine->add(fd, events);
 }
 
 //从内核事件表删除描述符
-void removefd(int epollfd, int fd)
+void removefd(event_engine *engine, int fd)
 {
-    //从epoll中删除fd_event事件
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    engine->del(fd);
     close(fd);
 }
 
-//将事件重置为EPOLLONESHOT
-void modfd(int epollfd, int fd, int ev, int TRIGMode)
-{
-    epoll_event event;
-    event.data.fd = fd;
-
-    if (1 == TRIGMode)
-        event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-    else
-        event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
-
-    epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
-}
-
 int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+atomic<bool> http_conn::m_draining(false);
+int http_conn::m_header_timeout = 10;
+int http_conn::m_body_rate = 1024;
+int http_conn::m_write_timeout = 15;
+int http_conn::m_idle_timeout = 15;
+event_engine *http_conn::m_engine = NULL;
+sql_executor *http_conn::m_sql_exec = NULL;
+user_store *http_conn::m_store = NULL;
+user_writer *http_conn::m_user_writer = NULL;
+mpsc_queue<cgi_task *> *http_conn::m_cgi_done = NULL;
+int http_conn::m_wakefd = -1;
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -109,9 +57,10 @@ void http_conn::close_conn(bool real_close)
     if (real_close && (m_sockfd != -1))
     {
         printf("close %d\n", m_sockfd);
-        removefd(m_epollfd, m_sockfd);
+        removefd(m_engine, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        m_conn_gen++;
     }
 }
 
@@ -121,13 +70,16 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_conn_gen++;
+    m_cgi_pending.store(false, memory_order_relaxed);
 
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    addfd(m_engine, sockfd, true, TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
     m_TRIGMode = TRIGMode;
+    m_ev_flags = EPOLLONESHOT | EPOLLRDHUP | (1 == TRIGMode ? EPOLLET : 0);
     m_close_log = close_log;
 
     strcpy(sql_user, user.c_str());
@@ -135,6 +87,7 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     strcpy(sql_name, sqlname.c_str());
 
     init();
+    m_t_accept = monotonic_us();
 }
 
 //初始化新接受的连接
@@ -158,7 +111,18 @@ void http_conn::init()
     cgi = 0;
     m_state = 0;
     timer_flag = 0;
-    improv = 0;
+    m_status = 0;
+    m_admitted = false;
+    m_t_first_read = 0;
+    m_t_enqueue = 0;
+    m_t_dequeue = 0;
+    m_t_parsed = 0;
+    m_t_handled = 0;
+    m_req_path[0] = '\0';
+    m_sid[0] = '\0';
+    m_new_sid[0] = '\0';
+    m_body = NULL;
+    m_content.clear();
 
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
@@ -213,6 +177,15 @@ http_conn::LINE_STATUS http_conn::parse_line()
 
 //循环读取客户数据，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
+//抓包时记录本次读到的原始字节，len为0表示对端关闭
+void http_conn::capture(int len)
+{
+    Capture *cap = Capture::get_instance();
+    if (cap->enabled())
+        cap->record(((uint64_t)m_conn_gen.load(memory_order_relaxed) << 32) | (uint32_t)m_sockfd, m_read_buf + m_read_idx, len);
+}
+
+template <int TRIG>
 bool http_conn::read_once()
 {
     if (m_read_idx >= READ_BUFFER_SIZE)
@@ -221,16 +194,37 @@ bool http_conn::read_once()
     }
     int bytes_read = 0;
 
+    //引擎已在内核中完成接收时直接取出数据，不再调用recv
+    if (m_engine->take_recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, bytes_read))
+    {
+        if (bytes_read <= 0)
+        {
+            if (bytes_read == 0)
+                capture(0);
+            return false;
+        }
+        if (m_read_idx == 0)
+            m_t_first_read = monotonic_us();
+        capture(bytes_read);
+        m_read_idx += bytes_read;
+        return true;
+    }
+
     //LT读取数据
-    if (0 == m_TRIGMode)
+    if constexpr (0 == TRIG)
     {
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-        m_read_idx += bytes_read;
+        if (bytes_read > 0 && m_read_idx == 0)
+            m_t_first_read = monotonic_us();
 
         if (bytes_read <= 0)
         {
+            if (bytes_read == 0)
+                capture(0);
             return false;
         }
+        capture(bytes_read);
+        m_read_idx += bytes_read;
 
         return true;
     }
@@ -248,13 +242,19 @@ bool http_conn::read_once()
             }
             else if (bytes_read == 0)
             {
+                capture(0);
                 return false;
             }
+            if (m_read_idx == 0)
+                m_t_first_read = monotonic_us();
+            capture(bytes_read);
             m_read_idx += bytes_read;
         }
         return true;
     }
 }
+template bool http_conn::read_once<0>();
+template bool http_conn::read_once<1>();
 
 //解析http请求行，获得请求方法，目标url及http版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
@@ -361,6 +361,24 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_host = text;
     }
+    //解析请求头部Cookie字段，只取会话id
+    else if (strncasecmp(text, "Cookie:", 7) == 0)
+    {
+        text += 7;
+        for (char *c = strstr(text, "sid="); c; c = strstr(c + 4, "sid="))
+        {
+            if (c != text && *(c - 1) != ' ' && *(c - 1) != ';')
+                continue;
+            c += 4;
+            size_t len = strcspn(c, "; \t");
+            if (len == session_table::SID_LEN)
+            {
+                memcpy(m_sid, c, len);
+                m_sid[len] = '\0';
+            }
+            break;
+        }
+    }
     else
     {
         LOG_INFO("oop!unknow header: %s", text);
@@ -421,6 +439,7 @@ http_conn::HTTP_CODE http_conn::process_read()
             //完整解析GET请求后，跳转到报文响应函数
             else if (ret == GET_REQUEST)
             {
+                m_t_parsed = monotonic_us();
                 return do_request();
             }
             break;
@@ -431,7 +450,10 @@ http_conn::HTTP_CODE http_conn::process_read()
             ret = parse_content(text);
             //完整解析POST请求后，跳转到报文响应函数
             if (ret == GET_REQUEST)
+            {
+                m_t_parsed = monotonic_us();
                 return do_request();
+            }
             //解析完消息体即完成报文解析，避免再次进入循环，更新line_status
             line_status = LINE_OPEN;
             break;
@@ -445,8 +467,21 @@ http_conn::HTTP_CODE http_conn::process_read()
 
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
+    if (AccessLog::get_instance()->enabled())
+    {
+        strncpy(m_req_path, m_url, sizeof(m_req_path) - 1);
+        m_req_path[sizeof(m_req_path) - 1] = '\0';
+    }
+
+    //保留路径，返回运行指标
+    PROBE3(request, m_sockfd, m_method, m_url);
+    if (m_method == GET && strcmp(m_url, "/metrics") == 0)
+    {
+        PROBE2(route, m_sockfd, "metrics");
+        Metrics::get_instance()->render(m_content);
+        return CONTENT_REQUEST;
+    }
+
     //printf("m_url:%s\n", m_url);
     const char *p = strrchr(m_url, '/');
 
@@ -457,12 +492,6 @@ http_conn::HTTP_CODE http_conn::do_request()
         //根据标志判断是登录检测还是注册检测
         char flag = m_url[1];
 
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
         //将用户名和密码提取出来
         //user=123&passwd=123
         char name[100], password[100];
@@ -478,42 +507,49 @@ http_conn::HTTP_CODE http_conn::do_request()
 
         if (*(p + 1) == '3')
         {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
+            PROBE2(route, m_sockfd, "register");
+            //如果是注册，先在内存表中原子地占用用户名，并发注册同名用户只有一个能成功
+            //开启后写时交给写线程合并落库并立即返回成功；否则由数据库线程写库，完成后再继续生成响应
+            user_table *users = user_table::GetInstance();
+            if (!users->insert(name, password))
+                strcpy(m_url, "/registerError.html");
+            else if (m_user_writer && m_user_writer->append(name, password))
+                strcpy(m_url, "/log.html");
+            else if (submit_cgi(register_job, name, password))
+                return ASYNC_REQUEST;
             else
+            {
+                users->erase(name);
                 strcpy(m_url, "/registerError.html");
+            }
         }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
+        //如果是登录，已有该用户的有效会话则直接通过，不再校验密码；否则在内存表中校验，不访问数据库
         else if (*(p + 1) == '2')
         {
-            if (users.find(name) != users.end() && users[name] == password)
+            PROBE2(route, m_sockfd, "login");
+            string user, passwd;
+            if (m_sid[0] && session_table::GetInstance()->check(m_sid, user) && user == name)
+                strcpy(m_url, "/welcome.html");
+            else if (user_table::GetInstance()->find(name, passwd) && passwd == password)
+            {
+                start_session(name);
                 strcpy(m_url, "/welcome.html");
+            }
             else
                 strcpy(m_url, "/logError.html");
         }
     }
 
+    return do_file_request();
+}
+
+//将m_url映射为root下的文件并mmap
+http_conn::HTTP_CODE http_conn::do_file_request()
+{
+    strcpy(m_real_file, doc_root);
+    int len = strlen(doc_root);
+    const char *p = strrchr(m_url, '/');
+
     if (*(p + 1) == '0')
     {
         char *m_url_real = (char *)malloc(sizeof(char) * 200);
@@ -566,7 +602,11 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
 
-    int fd = open(m_real_file, O_RDONLY);
+    PROBE3(route_file, m_sockfd, m_real_file, m_file_stat.st_size);
+    //空文件不映射，长度为0的mmap会失败
+    if (0 == m_file_stat.st_size)
+        return FILE_REQUEST;
+    int fd = open(m_real_file, O_RDONLY | O_CLOEXEC);
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
@@ -587,8 +627,8 @@ bool http_conn::write()
     //表示响应报文为空，一般不会会出现这样的情况
     if (bytes_to_send == 0)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         init();
+        rearm(EPOLLIN);
         return true;
     }
 
@@ -603,12 +643,14 @@ bool http_conn::write()
             //判断缓冲区是否满了
             if (errno == EAGAIN)
             {
+                PROBE3(write_partial, m_sockfd, bytes_have_send, bytes_to_send);
                 //重新注册写事件
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                rearm(EPOLLOUT);
                 return true;
             }
             //如果发送失败，但不是缓冲问题，取消映射
             unmap();
+            record_request(false);
             return false;
         }
         //正常发送，temp为发送的字节数
@@ -620,7 +662,7 @@ bool http_conn::write()
         {
             //不再继续发送头部信息
             m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_base = (char *)m_body + (bytes_have_send - m_write_idx);
             m_iv[1].iov_len = bytes_to_send;
         }
         //继续发送第二个头部信息
@@ -633,19 +675,21 @@ bool http_conn::write()
         //判断条件，数据已全部发送完
         if (bytes_to_send <= 0)
         {
+            PROBE3(write_done, m_sockfd, bytes_have_send, m_linger);
             unmap();
-            //在epoll树上重置EPOLLONESHOT事件
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            record_request(true);
 
             //浏览器的请求为长连接
             if (m_linger)
             {
-                //重新初始化HTTP对象
+                //重新初始化HTTP对象后再重置EPOLLONESHOT事件，重置之后连接可能已交给其他线程
                 init();
+                rearm(EPOLLIN);
                 return true;
             }
             else
             {
+                //短连接由调用方关闭，不再注册读事件
                 return false;
             }
         }
@@ -684,13 +728,14 @@ bool http_conn::add_response(const char *format, ...)
 //添加状态行
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 //添加状态头
 bool http_conn::add_headers(int content_len)
 {
     return add_content_length(content_len) && add_linger() &&
-           add_blank_line();
+           add_set_cookie() && add_blank_line();
 }
 //添加connection_Length,表示响应报文的长度
 bool http_conn::add_content_length(int content_len)
@@ -707,6 +752,14 @@ bool http_conn::add_linger()
 {
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+//登录成功时下发会话cookie
+bool http_conn::add_set_cookie()
+{
+    if (!m_new_sid[0])
+        return true;
+    return add_response("Set-Cookie:sid=%s; Max-Age=%d; Path=/; HttpOnly\r\n",
+                        m_new_sid, session_table::GetInstance()->ttl());
+}
 //添加空行
 bool http_conn::add_blank_line()
 {
@@ -753,6 +806,7 @@ bool http_conn::process_write(HTTP_CODE ret)
             add_headers(m_file_stat.st_size);
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
+            m_body = m_file_address;
             m_iv[1].iov_base = m_file_address;
             m_iv[1].iov_len = m_file_stat.st_size;
             m_iv_count = 2;
@@ -766,6 +820,21 @@ bool http_conn::process_write(HTTP_CODE ret)
             if (!add_content(ok_string))
                 return false;
         }
+        break;
+    }
+    case CONTENT_REQUEST:
+    {
+        add_status_line(200, ok_200_title);
+        add_response("Content-Type:%s\r\n", "text/plain; version=0.0.4");
+        add_headers(m_content.size());
+        m_body = m_content.data();
+        m_iv[0].iov_base = m_write_buf;
+        m_iv[0].iov_len = m_write_idx;
+        m_iv[1].iov_base = (char *)m_body;
+        m_iv[1].iov_len = m_content.size();
+        m_iv_count = 2;
+        bytes_to_send = m_write_idx + m_content.size();
+        return true;
     }
     default:
         return false;
@@ -777,22 +846,230 @@ bool http_conn::process_write(HTTP_CODE ret)
     return true;
 }
 
+bool http_conn::submit_cgi(void (*job)(void *), const char *name, const char *passwd)
+{
+    if (!m_sql_exec)
+        return false;
+    Metrics::get_instance()->inc(C_SQL_TASKS);
+    cgi_task *task = new cgi_task;
+    task->conn = this;
+    task->gen = m_conn_gen.load(memory_order_relaxed);
+    strcpy(task->name, name);
+    strcpy(task->passwd, passwd);
+    task->url = NULL;
+    //提交前置位，任务可能在submit返回前就已完成
+    m_cgi_pending.store(true, memory_order_release);
+    if (!m_sql_exec->submit(job, task))
+    {
+        m_cgi_pending.store(false, memory_order_relaxed);
+        delete task;
+        return false;
+    }
+    return true;
+}
+
+//在数据库线程中执行：写入存储后端，失败则回滚内存表，然后恢复该连接的响应
+void http_conn::register_job(void *arg)
+{
+    cgi_task *task = (cgi_task *)arg;
+    user_store::INSERT_RESULT ret = m_store->insert(task->name, task->passwd);
+    if (user_store::INSERT_EXISTS == ret)
+        m_store->refresh(task->name, user_table::GetInstance());
+    else if (user_store::INSERT_OK != ret)
+        user_table::GetInstance()->erase(task->name);
+    finish_cgi(task, user_store::INSERT_OK == ret ? "/log.html" : "/registerError.html");
+}
+
+//在数据库线程中执行：只记录结果，连接由主循环在resume_cgi中恢复，数据库线程不访问连接
+void http_conn::finish_cgi(cgi_task *task, const char *url)
+{
+    task->url = url;
+    //每个连接同一时刻最多一个任务，队列容量为MAX_FD，不会长时间满
+    while (!m_cgi_done->push(task))
+        sched_yield();
+    uint64_t one = 1;
+    ssize_t ret = ::write(m_wakefd, &one, sizeof(one));
+    (void)ret;
+}
+
+bool http_conn::resume_cgi(const cgi_task &task)
+{
+    //等待期间定时器不会关闭该连接，代数不一致说明连接已被关闭或复用，丢弃结果
+    if (m_conn_gen.load(memory_order_relaxed) != task.gen)
+        return false;
+    m_cgi_pending.store(false, memory_order_relaxed);
+    strcpy(m_url, task.url);
+    complete_request(do_file_request());
+    return true;
+}
+
+void http_conn::start_session(const char *user)
+{
+    if (session_table::GetInstance()->ttl() > 0)
+        session_table::GetInstance()->create(user, m_sid, m_new_sid);
+}
+
 void http_conn::process()
 {
+    if (!m_admitted && !admit())
+    {
+        shed();
+        return;
+    }
     HTTP_CODE read_ret = process_read();
+    PROBE2(parse, m_sockfd, read_ret);
     //NO_REQUEST，表示请求不完整，需要继续接收请求数据
     if (read_ret == NO_REQUEST)
     {
         //注册并监听读事件
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        rearm(EPOLLIN);
+        return;
+    }
+    //ASYNC_REQUEST，等待数据库线程完成后由主循环调用resume_cgi继续，期间不监听该连接
+    if (read_ret == ASYNC_REQUEST)
         return;
+    complete_request(read_ret);
+}
+
+//慢速客户端(slowloris)逐字节发送也不能一直占用连接：请求头的时限从首字节算起，之后的数据不再延长
+time_t http_conn::deadline(time_t now) const
+{
+    //发送中：每次有进展后重新计时
+    if (bytes_to_send > 0)
+        return now + m_write_timeout;
+    //还没有收到请求的数据：新连接或空闲的长连接
+    if (0 == m_read_idx)
+        return now + m_idle_timeout;
+    long long allowed_us = m_header_timeout * 1000000LL;
+    if (CHECK_STATE_CONTENT == m_check_state)
+    {
+        if (m_body_rate <= 0)
+            return now + m_idle_timeout;
+        //请求体每收到m_body_rate字节多给1秒
+        allowed_us += (m_read_idx - m_checked_idx) * 1000000LL / m_body_rate;
     }
+    long long left_us = m_t_first_read + allowed_us - monotonic_us();
+    return now + (left_us > 0 ? left_us / 1000000 : 0);
+}
+
+bool http_conn::admit()
+{
+    m_admitted = true;
+    overload *ctl = overload::GetInstance();
+    long long now = monotonic_us();
+    if (m_t_enqueue && m_t_dequeue && !ctl->admit_queued(m_t_dequeue - m_t_enqueue, m_t_accept != 0, now))
+    {
+        Metrics::get_instance()->inc(C_SHED_QUEUE);
+        return false;
+    }
+    if (!ctl->take_token(m_address.sin_addr.s_addr, now))
+    {
+        Metrics::get_instance()->inc(C_SHED_IP_RATE);
+        return false;
+    }
+    return true;
+}
+
+//不解析请求，直接发送固定的503，发送完成后按短连接关闭
+void http_conn::shed()
+{
+    PROBE1(shed, m_sockfd);
+    memcpy(m_write_buf, overload::RESPONSE, overload::RESPONSE_LEN);
+    m_write_idx = overload::RESPONSE_LEN;
+    m_linger = false;
+    m_status = 503;
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = m_write_idx;
+    m_iv_count = 1;
+    bytes_to_send = m_write_idx;
+    m_t_handled = monotonic_us();
+    rearm(EPOLLOUT);
+}
+
+void http_conn::complete_request(HTTP_CODE read_ret)
+{
+    if (m_draining.load(memory_order_relaxed))
+        m_linger = false;
     //调用process_write完成报文响应
     bool write_ret = process_write(read_ret);
+    m_t_handled = monotonic_us();
     if (!write_ret)
     {
+        record_request(false);
         close_conn();
     }
     //注册并监听写事件
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    rearm(EPOLLOUT);
+}
+
+//各阶段耗时：accept到首字节(仅连接上的第一个请求)、收齐请求、排队、解析、处理、发送
+//Reactor模式下读在出队之后，收齐请求的时间计入排队与解析
+void http_conn::record_request(bool ok)
+{
+    if (m_t_handled == 0)
+        return;
+
+    long long now = monotonic_us();
+    long long received = m_t_enqueue ? m_t_enqueue : m_t_dequeue;
+    long long start = received;
+    if (m_t_first_read && m_t_first_read < start)
+        start = m_t_first_read;
+
+    access_record rec;
+    rec.accept_us = m_t_accept && m_t_first_read ? m_t_first_read - m_t_accept : 0;
+    rec.read_us = m_t_first_read && received > m_t_first_read ? received - m_t_first_read : 0;
+    rec.queue_us = m_t_enqueue ? m_t_dequeue - m_t_enqueue : 0;
+    rec.parse_us = m_t_parsed ? m_t_parsed - m_t_dequeue : 0;
+    rec.handle_us = m_t_parsed ? m_t_handled - m_t_parsed : m_t_handled - m_t_dequeue;
+    rec.write_us = now - m_t_handled;
+    rec.total_us = now - start;
+    //accept耗时只统计一次，长连接上后续请求从首字节开始
+    bool first = m_t_accept != 0;
+    m_t_accept = 0;
+
+    Metrics *metrics = Metrics::get_instance();
+    if (!ok)
+        metrics->inc(C_WRITE_ERRORS);
+    else if (m_status >= 500)
+        metrics->inc(C_RESPONSES_5XX);
+    else if (m_status >= 400)
+        metrics->inc(C_RESPONSES_4XX);
+    else
+        metrics->inc(C_RESPONSES_2XX);
+    metrics->inc(C_BYTES_SENT, bytes_have_send);
+
+    if (first && m_t_first_read)
+        metrics->observe(H_ACCEPT, rec.accept_us);
+    if (m_t_first_read)
+        metrics->observe(H_READ, rec.read_us);
+    if (m_t_enqueue)
+        metrics->observe(H_QUEUE, rec.queue_us);
+    if (m_t_parsed)
+    {
+        metrics->observe(H_PARSE, rec.parse_us);
+        metrics->observe(H_HANDLE, rec.handle_us);
+    }
+    metrics->observe(H_WRITE, rec.write_us);
+    metrics->observe(H_TOTAL, rec.total_us);
+
+    log_access(ok, rec);
+}
+
+void http_conn::log_access(bool ok, access_record &rec)
+{
+    AccessLog *access = AccessLog::get_instance();
+    int status = ok ? m_status : 0;
+    if (!access->enabled() || !access->sampled(status, rec.total_us))
+        return;
+
+    char client[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, client, sizeof(client));
+
+    rec.client = client;
+    rec.method = method_names[m_method];
+    rec.path = m_req_path[0] ? m_req_path : (m_url ? m_url : "-");
+    rec.status = status;
+    rec.bytes = bytes_have_send;
+    rec.keep_alive = m_linger;
+    access->write(rec);
 }
@@ -23,8 +23,32 @@
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/user_table.h"
+#include "../CGImysql/user_store.h"
+#include "../CGImysql/sql_executor.h"
+#include "../CGImysql/user_writer.h"
 #include "../timer/lst_timer.h"
+#include "overload.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../log/capture.h"
+#include "session.h"
+#include "../metrics/metrics.h"
+#include "../trace/probes.h"
+#include "../event/event_engine.h"
+#include "../log/mpsc_queue.h"
+
+class http_conn;
+
+//登录/注册数据库任务，数据库线程填入结果后交回主循环，由主循环释放
+struct cgi_task
+{
+    http_conn *conn;
+    unsigned int gen;
+    char name[100];
+    char passwd[100];
+    const char *url;    //结果页面
+};
 
 class http_conn
 {
@@ -65,7 +89,9 @@ public:
         FORBIDDEN_REQUEST,              //表示客户对资源没有足够的访问权限。跳转process_write完成响应报文
         FILE_REQUEST,                   //请求资源可可以正常访问，跳转process_write完成响应报文
         INTERNAL_ERROR,                 //表示服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
-        CLOSED_CONNECTION               //表示客户端已经关闭
+        CLOSED_CONNECTION,              //表示客户端已经关闭
+        CONTENT_REQUEST,                //响应正文已生成在m_content中(如/metrics)，跳转process_write完成响应报文
+        ASYNC_REQUEST                   //表示已提交数据库线程，结果返回后再生成响应
     };
     //从状态机的状态
     enum LINE_STATUS
@@ -76,7 +102,7 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_conn_gen(0), m_cgi_pending(false), m_in_worker(0) {}
     ~http_conn() {}
 
 public:
@@ -85,18 +111,33 @@ public:
     //关闭http连接
     void close_conn(bool real_close = true);
     void process();
-    //读取浏览器端发来的全部数据
-    bool read_once();
+    //读取浏览器端发来的全部数据，TRIG为连接的触发模式(0为LT，1为ET)，调用方已知模式时直接使用对应实例
+    template <int TRIG> bool read_once();
+    bool read_once() { return 1 == m_TRIGMode ? read_once<1>() : read_once<0>(); }
     //响应报文写入函数
     bool write();
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    //同步线程初始化数据库读取表
-    void initmysql_result(connection_pool *connPool); //从连接池中取出一个解析后的http报文段内容
+    //按请求所处阶段计算连接的超时时刻，由主线程在连接上有读写后调用
+    time_t deadline(time_t now) const;
+    //连接上没有未完成的请求(未读到数据且没有待发送的响应)，停机排空时可直接关闭
+    //新连接的第一个请求可能已到达、只是还没有读出(io_uring下由引擎接收)，不算空闲；已交给工作线程的不算空闲
+    bool idle() const { return !in_worker() && m_read_idx == 0 && bytes_to_send == 0 && 0 == m_t_accept; }
+    //正在等待数据库结果，期间定时器不关闭该连接
+    bool cgi_pending() const { return m_cgi_pending.load(memory_order_acquire); }
+    //主循环交给工作线程前调用enter_worker，工作线程处理完调用leave_worker；
+    //计数非0时对象归工作线程所有，定时器和停机排空都不关闭该连接(fd不会被新连接复用)
+    //用计数而不是标志：工作线程重新注册事件后，主循环可能在它交回之前再次入队
+    void enter_worker() { m_in_worker.fetch_add(1, memory_order_relaxed); }
+    void leave_worker() { m_in_worker.fetch_sub(1, memory_order_release); }
+    bool in_worker() const { return m_in_worker.load(memory_order_acquire) > 0; }
+    unsigned int conn_gen() const { return m_conn_gen.load(memory_order_relaxed); }
+    //在主循环线程中调用：按数据库结果生成响应，连接已关闭或复用时返回false，task由调用方释放
+    bool resume_cgi(const cgi_task &task);
+    //Reactor模式下工作线程读写失败，主循环据此关闭连接
     int timer_flag;
-    int improv;
 
 
 private:
@@ -114,6 +155,16 @@ private:
     
     //生成响应报文
     HTTP_CODE do_request();
+    //将m_url映射为文件
+    HTTP_CODE do_file_request();
+    //根据处理结果生成响应并注册写事件
+    void complete_request(HTTP_CODE read_ret);
+    //注册写库提交到数据库执行器
+    bool submit_cgi(void (*job)(void *), const char *name, const char *passwd);
+    static void register_job(void *arg);
+    static void finish_cgi(cgi_task *task, const char *url);
+    //登录成功后创建会话，取代请求携带的旧会话，响应中下发cookie
+    void start_session(const char *user);
     //m_start_line是已经解析的字符
     //get_line用于将指针向后偏移，指向未处理的字符
     char *get_line() { return m_read_buf + m_start_line; };
@@ -121,6 +172,23 @@ private:
     LINE_STATUS parse_line();
 
     void unmap();
+    //重新注册EPOLLONESHOT事件，触发模式相关的事件位在init时算好
+    //等待请求数据时，支持完成式接收的引擎直接提交接收，长度不超过读缓冲区的剩余空间
+    void rearm(uint32_t ev)
+    {
+        if (EPOLLIN == ev)
+            m_engine->mod_recv(m_sockfd, ev | m_ev_flags, READ_BUFFER_SIZE - m_read_idx);
+        else
+            m_engine->mod(m_sockfd, ev | m_ev_flags);
+    }
+    //过载控制：请求的第一次处理时检查排队时延和客户端令牌，不通过则改为回复503
+    bool admit();
+    void shed();
+    //抓包开启时记录本次recv读到的数据
+    void capture(int len);
+    //请求结束：记录运行指标并按采样规则写访问日志，ok为false表示发送失败
+    void record_request(bool ok);
+    void log_access(bool ok, access_record &rec);
 
      //根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
     bool add_response(const char *format, ...);
@@ -130,17 +198,44 @@ private:
     bool add_content_type();
     bool add_content_length(int content_length);
     bool add_linger();
+    bool add_set_cookie();
     bool add_blank_line();
 
 public:
-    static int m_epollfd;
+    static event_engine *m_engine;
     static int m_user_count;
+    //停机排空中，之后的响应都带Connection: close，发送完即关闭
+    static atomic<bool> m_draining;
+    //各阶段时限：收齐请求头(秒，从首字节算起)、请求体最低速率(字节/秒)、发送无进展(秒)、长连接空闲(秒)
+    static int m_header_timeout;
+    static int m_body_rate;
+    static int m_write_timeout;
+    static int m_idle_timeout;
+    //数据库执行器，注册写库在其线程中异步完成
+    static sql_executor *m_sql_exec;
+    //用户凭据存储后端
+    static user_store *m_store;
+    //注册后写阶段，为NULL时注册走数据库执行器同步落库
+    static user_writer *m_user_writer;
+    //数据库线程把完成的任务放入m_cgi_done，再写m_wakefd唤醒主循环
+    static mpsc_queue<cgi_task *> *m_cgi_done;
+    static int m_wakefd;
     MYSQL *mysql;
     int m_state;  //读为0, 写为1
+    //各阶段单调时间戳(微秒)，入队和出队由线程池记录
+    long long m_t_accept;       //accept完成，连接上的第一个请求统计后清零
+    long long m_t_first_read;   //读到请求的第一个字节
+    long long m_t_enqueue;
+    long long m_t_dequeue;
+    long long m_t_parsed;
+    long long m_t_handled;
 
 private:
     int m_sockfd;
     sockaddr_in m_address;
+    atomic<unsigned int> m_conn_gen; //连接代数，关闭和复用该对象时加1，用于丢弃过期的异步结果
+    atomic<bool> m_cgi_pending;
+    atomic<int> m_in_worker;
     //存储读取的请求报文数据
     char m_read_buf[READ_BUFFER_SIZE];
     //缓冲区中m_read_buf中数据的最后一个字节的下一个位置
@@ -170,6 +265,8 @@ private:
 
     //读取服务器上的文件地址
     char *m_file_address;
+    string m_content;       //动态生成的响应正文
+    const char *m_body;     //响应正文地址，指向m_file_address或m_content
     struct stat m_file_stat;
     //io向量机制iovec
     struct iovec m_iv[2];
@@ -179,9 +276,14 @@ private:
     int bytes_to_send; //剩余发送字节数
     int bytes_have_send; //已发送字节数
     char *doc_root;
+    int m_status;        //响应状态码
+    bool m_admitted;     //当前请求已通过过载检查，请求不完整再次处理时不重复检查
+    char m_req_path[128]; //改写前的请求资源，用于访问日志
+    char m_sid[session_table::SID_LEN + 1];     //请求携带的会话cookie
+    char m_new_sid[session_table::SID_LEN + 1]; //本次响应要下发的会话cookie
 
-    map<string, string> m_users;
     int m_TRIGMode;
+    uint32_t m_ev_flags;    //EPOLLONESHOT | EPOLLRDHUP，ET时再加EPOLLET
     int m_close_log;
 
     char sql_user[100];
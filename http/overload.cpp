@@ -0,0 +1,145 @@
+#include <limits.h>
+#include <sys/socket.h>
+#include "overload.h"
+#include "../log/access_log.h"
+
+const char overload::RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                  "Content-Length: 0\r\n"
+                                  "Retry-After: 1\r\n"
+                                  "Connection: close\r\n\r\n";
+const int overload::RESPONSE_LEN = sizeof(overload::RESPONSE) - 1;
+
+overload::overload()
+{
+    m_target_us = 0;
+    m_ip_conn_limit = 0;
+    m_ip_rate = 0;
+    m_min_us = LLONG_MAX;
+    m_interval_end = 0;
+    m_overloaded = false;
+}
+
+overload *overload::GetInstance()
+{
+    static overload instance;
+    return &instance;
+}
+
+void overload::init(int target_ms, int ip_conn_limit, int ip_rate)
+{
+    m_target_us = target_ms * 1000LL;
+    m_ip_conn_limit = ip_conn_limit;
+    m_ip_rate = ip_rate;
+}
+
+bool overload::admit_queued(long long queue_us, bool first, long long now)
+{
+    if (m_target_us <= 0)
+        return true;
+
+    long long min = m_min_us.load(memory_order_relaxed);
+    while (queue_us < min && !m_min_us.compare_exchange_weak(min, queue_us, memory_order_relaxed))
+        ;
+    //窗口结束时由一个线程判定，整个窗口里都没有低于目标的请求说明队列一直没有排空
+    long long end = m_interval_end.load(memory_order_relaxed);
+    if (now >= end && m_interval_end.compare_exchange_strong(end, now + INTERVAL_US, memory_order_relaxed))
+        m_overloaded.store(m_min_us.exchange(LLONG_MAX, memory_order_relaxed) > m_target_us, memory_order_relaxed);
+
+    long long limit = (first && overloaded()) ? m_target_us : INTERVAL_US;
+    return queue_us <= limit;
+}
+
+bool overload::conn_open(uint32_t ip)
+{
+    if (m_ip_conn_limit <= 0)
+        return true;
+
+    shard &sh = shard_of(ip);
+    sh.lock.lock();
+    unordered_map<uint32_t, client>::iterator it = sh.clients.find(ip);
+    if (it == sh.clients.end())
+    {
+        client c;
+        c.conns = 0;
+        c.tokens = m_ip_rate;
+        c.last_us = monotonic_us();
+        it = sh.clients.insert(make_pair(ip, c)).first;
+    }
+    bool ok = it->second.conns < m_ip_conn_limit;
+    if (ok)
+        ++it->second.conns;
+    sh.lock.unlock();
+    return ok;
+}
+
+void overload::conn_close(uint32_t ip)
+{
+    if (m_ip_conn_limit <= 0)
+        return;
+
+    shard &sh = shard_of(ip);
+    sh.lock.lock();
+    unordered_map<uint32_t, client>::iterator it = sh.clients.find(ip);
+    if (it != sh.clients.end() && it->second.conns > 0)
+        --it->second.conns;
+    sh.lock.unlock();
+}
+
+bool overload::take_token(uint32_t ip, long long now)
+{
+    if (m_ip_rate <= 0)
+        return true;
+
+    shard &sh = shard_of(ip);
+    sh.lock.lock();
+    unordered_map<uint32_t, client>::iterator it = sh.clients.find(ip);
+    if (it == sh.clients.end())
+    {
+        client c;
+        c.conns = 0;
+        c.tokens = m_ip_rate;
+        c.last_us = now;
+        it = sh.clients.insert(make_pair(ip, c)).first;
+    }
+    client &c = it->second;
+    if (now > c.last_us)
+    {
+        c.tokens += (now - c.last_us) * m_ip_rate / 1000000.0;
+        if (c.tokens > m_ip_rate)
+            c.tokens = m_ip_rate;
+        c.last_us = now;
+    }
+    bool ok = c.tokens >= 1.0;
+    if (ok)
+        c.tokens -= 1.0;
+    sh.lock.unlock();
+    return ok;
+}
+
+void overload::expire()
+{
+    if (m_ip_conn_limit <= 0 && m_ip_rate <= 0)
+        return;
+
+    //没有连接且令牌已补满的记录与新客户端等价，可以删除
+    long long now = monotonic_us();
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        shard &sh = m_shards[i];
+        sh.lock.lock();
+        for (unordered_map<uint32_t, client>::iterator it = sh.clients.begin(); it != sh.clients.end();)
+        {
+            client &c = it->second;
+            if (c.conns == 0 && c.tokens + (now - c.last_us) * m_ip_rate / 1000000.0 >= m_ip_rate)
+                it = sh.clients.erase(it);
+            else
+                ++it;
+        }
+        sh.lock.unlock();
+    }
+}
+
+void overload::reject(int fd)
+{
+    send(fd, RESPONSE, RESPONSE_LEN, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
@@ -0,0 +1,71 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdint.h>
+#include <atomic>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//过载控制
+//排队时延：参考CoDel，以每个窗口(100ms)内出队请求的最小排队时延判断是否存在消不掉的积压，
+//  最小值超过目标时延即进入过载；过载时新连接的首个请求排队超过目标时延直接拒绝，
+//  已在进行中的长连接请求排队超过一个窗口才拒绝，优先保证已接入的客户端
+//按客户端ip：限制并发连接数，令牌桶限制每秒请求数(突发上限为一秒的量)
+//被拒绝的请求回复固定的503并关闭连接，不解析、不访问数据库
+class overload
+{
+public:
+    //单例模式
+    static overload *GetInstance();
+
+    //target_ms为排队时延目标，ip_conn_limit为单ip并发连接上限，ip_rate为单ip每秒请求数，0表示不限制
+    void init(int target_ms, int ip_conn_limit, int ip_rate);
+
+    //工作线程出队后调用，queue_us为排队时延，first为连接上的第一个请求，返回false表示应拒绝
+    bool admit_queued(long long queue_us, bool first, long long now);
+    //主线程accept后调用，超过单ip并发上限返回false；成功的连接关闭时须调用conn_close
+    bool conn_open(uint32_t ip);
+    void conn_close(uint32_t ip);
+    //每个请求取一个令牌，令牌不足返回false
+    bool take_token(uint32_t ip, long long now);
+    //清理空闲的客户端记录，由定时器周期调用
+    void expire();
+
+    bool overloaded() const { return m_overloaded.load(memory_order_relaxed); }
+
+    //直接在套接字上发送固定的503响应，不关闭连接
+    static void reject(int fd);
+    static const char RESPONSE[];
+    static const int RESPONSE_LEN;
+
+private:
+    overload();
+    ~overload() {}
+
+    static const int SHARD_NUM = 16;
+    static const long long INTERVAL_US = 100000;
+    struct client
+    {
+        int conns;
+        double tokens;
+        long long last_us;  //上次补充令牌的时刻
+    };
+    struct shard
+    {
+        locker lock;
+        unordered_map<uint32_t, client> clients;
+    };
+    shard &shard_of(uint32_t ip) { return m_shards[(ip ^ (ip >> 16)) % SHARD_NUM]; }
+
+    long long m_target_us;
+    int m_ip_conn_limit;
+    int m_ip_rate;
+    atomic<long long> m_min_us;         //本窗口内的最小排队时延
+    atomic<long long> m_interval_end;   //本窗口的结束时刻
+    atomic<bool> m_overloaded;
+    shard m_shards[SHARD_NUM];
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "session.h"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND           \
+    do                     \
+    {                      \
+        v0 += v1;          \
+        v1 = ROTL(v1, 13); \
+        v1 ^= v0;          \
+        v0 = ROTL(v0, 32); \
+        v2 += v3;          \
+        v3 = ROTL(v3, 16); \
+        v3 ^= v2;          \
+        v0 += v3;          \
+        v3 = ROTL(v3, 21); \
+        v3 ^= v0;          \
+        v2 += v1;          \
+        v1 = ROTL(v1, 17); \
+        v1 ^= v2;          \
+        v2 = ROTL(v2, 32); \
+    } while (0)
+
+//对单个64位消息计算SipHash-2-4
+static uint64_t siphash24(const uint64_t key[2], uint64_t m)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+
+    //长度8字节写入最高字节
+    uint64_t b = (uint64_t)8 << 56;
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+//从/dev/urandom读取随机数，失败时退化为时间与pid混合
+static void random_bytes(void *buf, size_t len)
+{
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    size_t got = 0;
+    if (fd >= 0)
+    {
+        while (got < len)
+        {
+            ssize_t n = read(fd, (char *)buf + got, len - got);
+            if (n <= 0)
+                break;
+            got += n;
+        }
+        close(fd);
+    }
+    if (got < len)
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
+        for (size_t i = 0; i < len; ++i)
+            ((unsigned char *)buf)[i] = random() & 0xff;
+    }
+}
+
+static bool parse_hex(const char *s, int len, uint64_t &v)
+{
+    v = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        char c = s[i];
+        int d;
+        if (c >= '0' && c <= '9')
+            d = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            d = c - 'a' + 10;
+        else
+            return false;
+        v = v << 4 | d;
+    }
+    return true;
+}
+
+session_table::session_table() : m_ttl(1800)
+{
+    random_bytes(m_key, sizeof(m_key));
+}
+
+session_table *session_table::GetInstance()
+{
+    static session_table table;
+    return &table;
+}
+
+void session_table::init(int ttl)
+{
+    m_ttl = ttl;
+}
+
+uint64_t session_table::sign(uint64_t id) const
+{
+    return siphash24(m_key, id);
+}
+
+bool session_table::parse(const char *sid, uint64_t &id) const
+{
+    uint64_t mac;
+    if (!parse_hex(sid, 16, id) || !parse_hex(sid + 16, 16, mac) || sid[SID_LEN] != '\0')
+        return false;
+    return sign(id) == mac;
+}
+
+session_table::session_iter session_table::drop(shard &sh, session_iter it)
+{
+    unordered_map<string, deque<uint64_t> >::iterator u = sh.users.find(it->second.user);
+    if (u != sh.users.end())
+    {
+        deque<uint64_t> &ids = u->second;
+        for (deque<uint64_t>::iterator i = ids.begin(); i != ids.end(); ++i)
+        {
+            if (*i == it->first)
+            {
+                ids.erase(i);
+                break;
+            }
+        }
+        if (ids.empty())
+            sh.users.erase(u);
+    }
+    return sh.sessions.erase(it);
+}
+
+void session_table::create(const char *user, const char *old, char *sid)
+{
+    //携带的旧会话被取代，反复登录的客户端不会使会话表增长
+    uint64_t id;
+    if (old[0] && parse(old, id))
+    {
+        shard &sh = m_shards[id % SHARD_NUM];
+        sh.lock.lock();
+        session_iter it = sh.sessions.find(id);
+        if (it != sh.sessions.end())
+            drop(sh, it);
+        sh.lock.unlock();
+    }
+
+    //低位换成用户名哈希对应的分片号，同一用户的会话集中在一个分片
+    unsigned idx = hash<string>()(user) % SHARD_NUM;
+    random_bytes(&id, sizeof(id));
+    id = id - id % SHARD_NUM + idx;
+    snprintf(sid, SID_LEN + 1, "%016llx%016llx", (unsigned long long)id, (unsigned long long)sign(id));
+
+    shard &sh = m_shards[idx];
+    sh.lock.lock();
+    deque<uint64_t> &ids = sh.users[user];
+    //超过每用户上限时淘汰最早的会话
+    while ((int)ids.size() >= MAX_PER_USER)
+    {
+        sh.sessions.erase(ids.front());
+        ids.pop_front();
+    }
+    ids.push_back(id);
+    session &s = sh.sessions[id];
+    s.user = user;
+    s.expire = time(NULL) + m_ttl;
+    sh.lock.unlock();
+}
+
+bool session_table::check(const char *sid, string &user)
+{
+    //签名不对的直接拒绝，不触碰会话表
+    uint64_t id;
+    if (!parse(sid, id))
+        return false;
+
+    shard &sh = m_shards[id % SHARD_NUM];
+    bool ok = false;
+    sh.lock.lock();
+    session_iter it = sh.sessions.find(id);
+    if (it != sh.sessions.end())
+    {
+        if (it->second.expire > time(NULL))
+        {
+            user = it->second.user;
+            ok = true;
+        }
+        else
+            drop(sh, it);
+    }
+    sh.lock.unlock();
+    return ok;
+}
+
+void session_table::expire()
+{
+    time_t now = time(NULL);
+    for (int i = 0; i < SHARD_NUM; ++i)
+    {
+        shard &sh = m_shards[i];
+        sh.lock.lock();
+        for (session_iter it = sh.sessions.begin(); it != sh.sessions.end();)
+        {
+            if (it->second.expire <= now)
+                it = drop(sh, it);
+            else
+                ++it;
+        }
+        sh.lock.unlock();
+    }
+}
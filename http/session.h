@@ -0,0 +1,66 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//登录会话表
+//会话id为64位随机数，cookie值为 id的16位十六进制 + 以随机密钥计算的SipHash-2-4签名
+//校验先验签名，伪造或篡改的cookie不查表直接拒绝；再按id查所在分片，O(1)判断是否存在和过期
+//id的低位取自用户名的哈希，同一用户的会话都在同一分片，每个用户最多保留MAX_PER_USER个，超出时淘汰最早的
+class session_table
+{
+public:
+    static const int SID_LEN = 32; //cookie值长度
+    static const int MAX_PER_USER = 8;
+
+    //单例模式
+    static session_table *GetInstance();
+
+    //ttl为会话有效期(秒)
+    void init(int ttl);
+    int ttl() const { return m_ttl; }
+
+    //为用户创建会话，sid写入SID_LEN+1字节的缓冲区；old为请求携带的cookie值，有效时该会话被新会话取代
+    void create(const char *user, const char *old, char *sid);
+    //校验cookie值，有效则把用户名写入user
+    bool check(const char *sid, string &user);
+    //清理过期会话，由定时器周期调用
+    void expire();
+
+private:
+    session_table();
+    ~session_table() {}
+
+    uint64_t sign(uint64_t id) const;
+    //解析并验签cookie值，得到会话id
+    bool parse(const char *sid, uint64_t &id) const;
+
+    static const int SHARD_NUM = 16;
+    struct session
+    {
+        string user;
+        time_t expire;
+    };
+    struct shard
+    {
+        locker lock;
+        unordered_map<uint64_t, session> sessions;
+        unordered_map<string, deque<uint64_t> > users;  //每个用户的会话id，按创建先后
+    };
+    typedef unordered_map<uint64_t, session>::iterator session_iter;
+    //删除会话并从所属用户的列表中摘除，需持有分片锁
+    session_iter drop(shard &sh, session_iter it);
+
+    int m_ttl;
+    uint64_t m_key[2];      //签名密钥，进程启动时随机生成
+    shard m_shards[SHARD_NUM];
+};
+
+#endif
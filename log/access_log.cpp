@@ -0,0 +1,105 @@
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include "access_log.h"
+
+using namespace std;
+
+AccessLog::AccessLog()
+{
+    m_enabled = false;
+    m_sample_rate = 0;
+    m_slow_us = 0;
+    m_counter = 0;
+    m_dropped = 0;
+    m_fp = NULL;
+    m_queue = NULL;
+}
+
+AccessLog::~AccessLog()
+{
+    if (m_fp != NULL)
+    {
+        fclose(m_fp);
+    }
+}
+
+bool AccessLog::init(const char *file_name, int sample_rate, int slow_ms, int max_queue_size)
+{
+    if (sample_rate <= 0)
+        return false;
+
+    time_t t = time(NULL);
+    struct tm my_tm = *localtime(&t);
+
+    //与运行日志一致，以“时间+文件名”作为日志名
+    char full_name[256] = {0};
+    const char *p = strrchr(file_name, '/');
+    if (p == NULL)
+        snprintf(full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+    else
+        snprintf(full_name, 255, "%.*s%d_%02d_%02d_%s", (int)(p - file_name + 1), file_name,
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, p + 1);
+
+    m_fp = fopen(full_name, "ae");
+    if (m_fp == NULL)
+        return false;
+    fputs("#time client method status bytes keep_alive accept_us read_us queue_us parse_us handle_us write_us total_us path\n", m_fp);
+
+    m_sample_rate = sample_rate;
+    m_slow_us = slow_ms * 1000LL;
+    m_queue = new mpsc_queue<string>(max_queue_size);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, flush_access_thread, NULL);
+    m_enabled = true;
+    return true;
+}
+
+//固定字段，空格分隔，path放在最后
+void AccessLog::write(const access_record &rec)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    time_t t = now.tv_sec;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf), "%d-%02d-%02dT%02d:%02d:%02d.%06ld %s %s %d %ld %d %lld %lld %lld %lld %lld %lld %lld %s\n",
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec,
+                     rec.client, rec.method, rec.status, rec.bytes, rec.keep_alive ? 1 : 0,
+                     rec.accept_us, rec.read_us, rec.queue_us, rec.parse_us, rec.handle_us, rec.write_us, rec.total_us,
+                     rec.path ? rec.path : "-");
+    if (n >= (int)sizeof(buf))
+    {
+        buf[sizeof(buf) - 2] = '\n';
+        n = sizeof(buf) - 1;
+    }
+
+    if (!m_queue->push(string(buf, n)))
+        m_dropped.fetch_add(1, memory_order_relaxed);
+}
+
+void AccessLog::async_write()
+{
+    vector<string> batch;
+    batch.reserve(BATCH_SIZE);
+    unsigned long reported = 0;
+    while (m_queue->pop_batch(batch, BATCH_SIZE) > 0)
+    {
+        for (size_t i = 0; i < batch.size(); ++i)
+            fputs(batch[i].c_str(), m_fp);
+        batch.clear();
+
+        //队列满丢弃的记录数写入日志，便于判断采样是否失真
+        unsigned long dropped = m_dropped.load(memory_order_relaxed);
+        if (dropped != reported)
+        {
+            fprintf(m_fp, "#dropped %lu\n", dropped - reported);
+            reported = dropped;
+        }
+        fflush(m_fp);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <string>
+#include <atomic>
+#include <time.h>
+#include <pthread.h>
+#include "mpsc_queue.h"
+
+using namespace std;
+
+//单调时钟，微秒
+inline long long monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+//一条访问记录，各阶段耗时单位为微秒
+struct access_record
+{
+    const char *client;     //客户端ip
+    const char *method;     //请求方法
+    const char *path;       //请求资源
+    int status;             //响应状态码，0表示未生成响应
+    long bytes;             //已发送字节数
+    bool keep_alive;        //是否长连接
+    long long accept_us;    //accept到读到首字节，仅连接上的第一个请求
+    long long read_us;      //首字节到收齐请求(最后一次入队)
+    long long queue_us;     //请求队列中等待
+    long long parse_us;     //报文解析
+    long long handle_us;    //do_request及生成响应
+    long long write_us;     //发送响应
+    long long total_us;     //首字节(或入队)到发送完成
+};
+
+//访问日志，单独的文件与写线程
+//采样规则：错误(status >= 400或发送失败)与慢请求全部记录，其余每sample_rate条记录一条
+class AccessLog
+{
+public:
+    static AccessLog *get_instance()
+    {
+        static AccessLog instance;
+        return &instance;
+    }
+
+    static void *flush_access_thread(void *args)
+    {
+        AccessLog::get_instance()->async_write();
+        return NULL;
+    }
+
+    //sample_rate为0表示关闭访问日志，slow_ms为慢请求阈值
+    bool init(const char *file_name, int sample_rate, int slow_ms, int max_queue_size = 8192);
+
+    bool enabled() const { return m_enabled; }
+
+    //判断是否需要记录该请求，无需记录时不做任何格式化
+    bool sampled(int status, long long total_us)
+    {
+        if (status == 0 || status >= 400 || total_us >= m_slow_us)
+            return true;
+        return (m_counter.fetch_add(1, memory_order_relaxed) % m_sample_rate) == 0;
+    }
+
+    void write(const access_record &rec);
+
+private:
+    AccessLog();
+    ~AccessLog();
+    void async_write();
+
+private:
+    static const int BATCH_SIZE = 64;
+
+    bool m_enabled;
+    int m_sample_rate;
+    long long m_slow_us;
+    atomic<unsigned long> m_counter;
+    atomic<unsigned long> m_dropped;    //队列满丢弃的条数
+    FILE *m_fp;
+    mpsc_queue<string> *m_queue;
+};
+
+#endif
@@ -1,6 +1,7 @@
 /*************************************************************
 *循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;  
 *线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
+*m_size为原子变量，full/empty/size只读不加锁；pop_batch一次加锁取出多条
 **************************************************************/
 
 #ifndef BLOCK_QUEUE_H
@@ -10,6 +11,9 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <atomic>
+#include <vector>
+#include <utility>
 #include "../lock/locker.h"
 using namespace std;
 
@@ -51,27 +55,12 @@ public:
     //判断队列是否满了
     bool full() 
     {
-        m_mutex.lock();
-        if (m_size >= m_max_size)
-        {
-
-            m_mutex.unlock();
-            return true;
-        }
-        m_mutex.unlock();
-        return false;
+        return m_size.load(memory_order_relaxed) >= m_max_size;
     }
     //判断队列是否为空
     bool empty() 
     {
-        m_mutex.lock();
-        if (0 == m_size)
-        {
-            m_mutex.unlock();
-            return true;
-        }
-        m_mutex.unlock();
-        return false;
+        return 0 == m_size.load(memory_order_relaxed);
     }
     //返回队首元素
     bool front(T &value) 
@@ -102,36 +91,21 @@ public:
 
     int size() 
     {
-        int tmp = 0;
-
-        m_mutex.lock();
-        tmp = m_size;
-
-        m_mutex.unlock();
-        return tmp;
+        return m_size.load(memory_order_relaxed);
     }
 
     int max_size()
     {
-        int tmp = 0;
-
-        m_mutex.lock();
-        tmp = m_max_size;
-
-        m_mutex.unlock();
-        return tmp;
+        return m_max_size;
     }
-    //往队列添加元素，需要将所有使用队列的线程先唤醒
+    //往队列添加元素，唤醒一个等待的消费者
     //当有元素push进队列,相当于生产者生产了一个元素
     //若当前没有线程等待条件变量,则唤醒无意义
     bool push(const T &item)
     {
-
         m_mutex.lock();
         if (m_size >= m_max_size)
         {
-
-            m_cond.broadcast();
             m_mutex.unlock();
             return false;
         }
@@ -141,7 +115,27 @@ public:
 
         m_size++;
 
-        m_cond.broadcast();
+        m_cond.signal();
+        m_mutex.unlock();
+        return true;
+    }
+
+    //移动语义版本，队列满时item保持不变
+    bool push(T &&item)
+    {
+        m_mutex.lock();
+        if (m_size >= m_max_size)
+        {
+            m_mutex.unlock();
+            return false;
+        }
+
+        m_back = (m_back + 1) % m_max_size;
+        m_array[m_back] = std::move(item);
+
+        m_size++;
+
+        m_cond.signal();
         m_mutex.unlock();
         return true;
     }
@@ -161,12 +155,38 @@ public:
         }
 
         m_front = (m_front + 1) % m_max_size;
-        item = m_array[m_front];
+        item = std::move(m_array[m_front]);
         m_size--;
         m_mutex.unlock();
         return true;
     }
 
+    //一次加锁最多取出max_items条追加到items末尾，队列为空时等待条件变量
+    //返回取出的条数，等待失败返回0
+    int pop_batch(vector<T> &items, int max_items)
+    {
+        m_mutex.lock();
+        while (m_size <= 0)
+        {
+            if (!m_cond.wait(m_mutex.get()))
+            {
+                m_mutex.unlock();
+                return 0;
+            }
+        }
+
+        int n = 0;
+        while (m_size > 0 && n < max_items)
+        {
+            m_front = (m_front + 1) % m_max_size;
+            items.push_back(std::move(m_array[m_front]));
+            m_size--;
+            n++;
+        }
+        m_mutex.unlock();
+        return n;
+    }
+
     //增加了超时处理
     bool pop(T &item, int ms_timeout)
     {
@@ -176,8 +196,9 @@ public:
         m_mutex.lock();
         if (m_size <= 0)
         {
-            t.tv_sec = now.tv_sec + ms_timeout / 1000;
-            t.tv_nsec = (ms_timeout % 1000) * 1000;
+            long nsec = now.tv_usec * 1000L + (ms_timeout % 1000) * 1000000L;
+            t.tv_sec = now.tv_sec + ms_timeout / 1000 + nsec / 1000000000L;
+            t.tv_nsec = nsec % 1000000000L;
             if (!m_cond.timewait(m_mutex.get(), t)) //pthread_cond_timedwait()中的&t需要时间的绝对值
             {
                 m_mutex.unlock();
@@ -192,7 +213,7 @@ public:
         }
 
         m_front = (m_front + 1) % m_max_size;
-        item = m_array[m_front];
+        item = std::move(m_array[m_front]);
         m_size--;
         m_mutex.unlock();
         return true;
@@ -203,7 +224,7 @@ private:
     cond m_cond;
 
     T *m_array;
-    int m_size;
+    atomic<int> m_size;
     int m_max_size;
     int m_front;
     int m_back;
@@ -0,0 +1,105 @@
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "capture.h"
+#include "access_log.h"
+
+using namespace std;
+
+Capture::Capture()
+{
+    m_enabled = false;
+    m_start = 0;
+    m_max_bytes = 0;
+    m_bytes = 0;
+    m_dropped = 0;
+    m_fp = NULL;
+    m_queue = NULL;
+}
+
+Capture::~Capture()
+{
+    if (m_fp != NULL)
+    {
+        fclose(m_fp);
+    }
+}
+
+bool Capture::init(const char *file_name, int max_mb, int max_queue_size)
+{
+    if (max_mb <= 0)
+        return false;
+
+    time_t t = time(NULL);
+    struct tm my_tm = *localtime(&t);
+
+    //与运行日志一致，以“时间+文件名”作为文件名
+    char full_name[256] = {0};
+    const char *p = strrchr(file_name, '/');
+    if (p == NULL)
+        snprintf(full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+    else
+        snprintf(full_name, 255, "%.*s%d_%02d_%02d_%s", (int)(p - file_name + 1), file_name,
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, p + 1);
+
+    //每次启动重新抓取，时间戳从0开始
+    m_fp = fopen(full_name, "we");
+    if (m_fp == NULL)
+        return false;
+    fwrite(CAPTURE_MAGIC, 1, 8, m_fp);
+
+    m_start = monotonic_us();
+    m_max_bytes = max_mb * 1024LL * 1024LL;
+    m_queue = new mpsc_queue<string>(max_queue_size);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, flush_capture_thread, NULL);
+    m_enabled = true;
+    return true;
+}
+
+void Capture::record(uint64_t conn, const char *data, int len)
+{
+    //达到大小上限后停止，已写入的记录保持完整
+    long long size = sizeof(capture_record) + len;
+    if (m_bytes.fetch_add(size, memory_order_relaxed) + size > m_max_bytes)
+    {
+        m_enabled.store(false, memory_order_relaxed);
+        return;
+    }
+
+    capture_record rec;
+    rec.conn = conn;
+    rec.t_us = monotonic_us() - m_start;
+    rec.len = len;
+    string buf((const char *)&rec, sizeof(rec));
+    buf.append(data, len);
+    if (!m_queue->push(std::move(buf)))
+        m_dropped.fetch_add(1, memory_order_relaxed);
+}
+
+void Capture::async_write()
+{
+    vector<string> batch;
+    batch.reserve(BATCH_SIZE);
+    unsigned long reported = 0;
+    while (m_queue->pop_batch(batch, BATCH_SIZE) > 0)
+    {
+        for (size_t i = 0; i < batch.size(); ++i)
+            fwrite(batch[i].data(), 1, batch[i].size(), m_fp);
+        batch.clear();
+
+        //丢弃的记录会使回放时该连接的请求不完整，记下数量供回放工具提示
+        unsigned long dropped = m_dropped.load(memory_order_relaxed);
+        if (dropped != reported)
+        {
+            capture_record rec;
+            rec.conn = CAPTURE_DROPPED;
+            rec.t_us = monotonic_us() - m_start;
+            rec.len = dropped - reported;
+            fwrite(&rec, 1, sizeof(rec), m_fp);
+            reported = dropped;
+        }
+        fflush(m_fp);
+    }
+}
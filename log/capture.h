@@ -0,0 +1,68 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <pthread.h>
+#include "mpsc_queue.h"
+
+using namespace std;
+
+//抓包文件格式(本机字节序)：文件头8字节CAPTURE_MAGIC，之后为连续的记录
+//每条记录为capture_record头加len字节数据，数据是一次recv读到的原始字节
+//len为0表示客户端关闭了连接；conn为CAPTURE_DROPPED时len为因队列满丢弃的记录数
+#define CAPTURE_MAGIC "WSCAP001"
+
+struct capture_record
+{
+    uint64_t conn;      //连接标识，连接代数<<32 | sockfd，进程内唯一
+    uint64_t t_us;      //相对开始抓包的时刻，微秒
+    uint32_t len;
+} __attribute__((packed));
+
+static const uint64_t CAPTURE_DROPPED = ~0ULL;
+
+//请求抓包，单独的文件与写线程，供test_pressure/replay回放
+class Capture
+{
+public:
+    static Capture *get_instance()
+    {
+        static Capture instance;
+        return &instance;
+    }
+
+    static void *flush_capture_thread(void *args)
+    {
+        Capture::get_instance()->async_write();
+        return NULL;
+    }
+
+    //max_mb为文件大小上限，写满后停止抓包，0表示关闭
+    bool init(const char *file_name, int max_mb, int max_queue_size = 8192);
+
+    bool enabled() const { return m_enabled.load(memory_order_relaxed); }
+
+    //记录一次读到的数据，len为0表示连接被对端关闭
+    void record(uint64_t conn, const char *data, int len);
+
+private:
+    Capture();
+    ~Capture();
+    void async_write();
+
+private:
+    static const int BATCH_SIZE = 64;
+
+    atomic<bool> m_enabled;
+    long long m_start;
+    long long m_max_bytes;
+    atomic<long long> m_bytes;
+    atomic<unsigned long> m_dropped;
+    FILE *m_fp;
+    mpsc_queue<string> *m_queue;
+};
+
+#endif
@@ -26,7 +26,7 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
     if (max_queue_size >= 1)
     {
         m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
+        m_log_queue = new mpsc_queue<string>(max_queue_size);
         pthread_t tid;
         //flush_log_thread为回调函数,这里表示创建线程异步写日志
         pthread_create(&tid, NULL, flush_log_thread, NULL);
@@ -62,7 +62,8 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
 
     m_today = my_tm.tm_mday;
     
-    m_fp = fopen(log_full_name, "a");
+    //e：close-on-exec，热升级exec新进程时不继承日志文件
+    m_fp = fopen(log_full_name, "ae");
     if (m_fp == NULL)
     {
         return false;
@@ -122,7 +123,7 @@ void Log::write_log(int level, const char *format, ...)
         {
             snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
         }
-        m_fp = fopen(new_log, "a");
+        m_fp = fopen(new_log, "ae");
     }
  
     m_mutex.unlock();
@@ -145,11 +146,8 @@ void Log::write_log(int level, const char *format, ...)
 
     m_mutex.unlock();
 
-    if (m_is_async && !m_log_queue->full())         //异步且阻塞队列未满，则将日志信息加入阻塞队列
-    {
-        m_log_queue->push(log_str);
-    }
-    else                                             //同步则加锁向文件中写
+    //异步且队列未满，则将日志信息移动进队列；队列满或同步则加锁向文件中写
+    if (!m_is_async || !m_log_queue->push(std::move(log_str)))
     {
         m_mutex.lock();
         fputs(log_str.c_str(), m_fp);
@@ -161,6 +159,9 @@ void Log::write_log(int level, const char *format, ...)
 
 void Log::flush(void)
 {
+    //异步模式下由写线程每批刷新一次
+    if (m_is_async)
+        return;
     m_mutex.lock();
     //强制刷新写入流缓冲区
     fflush(m_fp);
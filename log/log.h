@@ -6,7 +6,9 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
+#include <vector>
 #include "block_queue.h"
+#include "mpsc_queue.h"
 
 using namespace std;
 
@@ -23,6 +25,7 @@ public:
     static void *flush_log_thread(void *args)       //异步写日志的公有方法，调用私有方法async_write_log()
     {
         Log::get_instance()->async_write_log();
+        return NULL;
     }
     //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
     bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
@@ -36,14 +39,19 @@ private:
     virtual ~Log();
     void *async_write_log()
     {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
+        vector<string> batch;
+        batch.reserve(LOG_BATCH_SIZE);
+        //每次唤醒从队列中批量取出日志string，一次加锁写入文件并刷新
+        while (m_log_queue->pop_batch(batch, LOG_BATCH_SIZE) > 0)
         {
             m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
+            for (size_t i = 0; i < batch.size(); ++i)
+                fputs(batch[i].c_str(), m_fp);
+            fflush(m_fp);
             m_mutex.unlock();
+            batch.clear();
         }
+        return NULL;
     }
 
 private:
@@ -55,7 +63,8 @@ private:
     int m_today;        //因为按天分类,记录当前时间是那一天
     FILE *m_fp;         //打开log的文件指针
     char *m_buf;        //要输出的内容
-    block_queue<string> *m_log_queue; //阻塞队列
+    static const int LOG_BATCH_SIZE = 64; //异步线程每次最多取出的日志条数
+    mpsc_queue<string> *m_log_queue; //多生产者单消费者无锁队列
     bool m_is_async;                  //是否同步标志位
     locker m_mutex;                     //同步类
     int m_close_log; //关闭日志
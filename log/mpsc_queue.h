@@ -0,0 +1,272 @@
+/*************************************************************
+*多生产者单消费者(MPSC)无锁有界队列
+*基于每个槽位的序号(sequence)实现，生产者之间通过CAS竞争m_tail，
+*消费者只有一个，m_head无需同步；仅在消费者休眠时才借助互斥锁+条件变量唤醒
+*pop_batch一次唤醒取出多条，并使用移动语义避免拷贝std::string
+**************************************************************/
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "../lock/locker.h"
+using namespace std;
+
+template <class T>
+class mpsc_queue
+{
+public:
+    mpsc_queue(int max_size = 1000)
+    {
+        if (max_size <= 0)
+        {
+            exit(-1);
+        }
+
+        //容量向上取整为2的幂，用位与代替取模
+        size_t cap = 1;
+        while (cap < (size_t)max_size)
+            cap <<= 1;
+        m_capacity = cap;
+        m_mask = cap - 1;
+        m_slots = new slot[cap];
+        for (size_t i = 0; i < cap; ++i)
+            m_slots[i].seq.store(i, memory_order_relaxed);
+
+        m_tail.store(0, memory_order_relaxed);
+        m_head = 0;
+        m_head_pub.store(0, memory_order_relaxed);
+        m_sleeping.store(false, memory_order_relaxed);
+        m_closed.store(false, memory_order_relaxed);
+    }
+
+    ~mpsc_queue()
+    {
+        delete[] m_slots;
+    }
+
+    //生产者入队，队列满返回false，此时item保持不变
+    bool push(const T &item)
+    {
+        slot *s = claim();
+        if (!s)
+            return false;
+        s->data = item;
+        publish(s);
+        return true;
+    }
+
+    bool push(T &&item)
+    {
+        slot *s = claim();
+        if (!s)
+            return false;
+        s->data = std::move(item);
+        publish(s);
+        return true;
+    }
+
+    //以下三个函数只能由唯一的消费者线程调用
+    //阻塞取出一条，队列关闭且为空时返回false
+    bool pop(T &item)
+    {
+        while (!try_pop(item))
+        {
+            if (!wait_nonempty(-1))
+                return false;
+        }
+        return true;
+    }
+
+    //增加了超时处理
+    bool pop(T &item, int ms_timeout)
+    {
+        if (try_pop(item))
+            return true;
+        wait_nonempty(ms_timeout);
+        return try_pop(item);
+    }
+
+    //一次唤醒最多取出max_items条追加到items末尾，返回取出的条数
+    //ms_timeout < 0 表示一直等待，直到有数据或队列被关闭
+    int pop_batch(vector<T> &items, int max_items, int ms_timeout = -1)
+    {
+        int n = drain(items, max_items);
+        while (n == 0)
+        {
+            if (!wait_nonempty(ms_timeout))
+                return drain(items, max_items);
+            n = drain(items, max_items);
+            if (ms_timeout >= 0)
+                break;
+        }
+        return n;
+    }
+
+    //关闭队列，唤醒消费者；已入队的数据仍可取出
+    void close()
+    {
+        m_closed.store(true);
+        m_mutex.lock();
+        m_cond.signal();
+        m_mutex.unlock();
+    }
+
+    //以下为近似值，仅用于统计与判断，不加锁
+    int size()
+    {
+        size_t tail = m_tail.load(memory_order_acquire);
+        size_t head = m_head_pub.load(memory_order_acquire);
+        return tail > head ? (int)(tail - head) : 0;
+    }
+
+    bool empty()
+    {
+        return size() == 0;
+    }
+
+    bool full()
+    {
+        return size() >= (int)m_capacity;
+    }
+
+    int max_size()
+    {
+        return (int)m_capacity;
+    }
+
+private:
+    struct slot
+    {
+        atomic<size_t> seq;
+        T data;
+    };
+
+    //生产者抢占一个槽位，队列满返回NULL
+    slot *claim()
+    {
+        size_t pos = m_tail.load(memory_order_relaxed);
+        for (;;)
+        {
+            slot *s = &m_slots[pos & m_mask];
+            size_t seq = s->seq.load(memory_order_acquire);
+            long dif = (long)seq - (long)pos;
+            if (dif == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    return s;
+            }
+            else if (dif < 0)
+                return NULL;
+            else
+                pos = m_tail.load(memory_order_relaxed);
+        }
+    }
+
+    //发布槽位，若消费者正在休眠则唤醒它
+    void publish(slot *s)
+    {
+        size_t pos = s->seq.load(memory_order_relaxed);
+        s->seq.store(pos + 1, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (m_sleeping.load(memory_order_relaxed))
+        {
+            m_mutex.lock();
+            m_cond.signal();
+            m_mutex.unlock();
+        }
+    }
+
+    bool try_pop(T &item)
+    {
+        slot *s = &m_slots[m_head & m_mask];
+        if (s->seq.load(memory_order_acquire) != m_head + 1)
+            return false;
+        item = std::move(s->data);
+        s->seq.store(m_head + m_capacity, memory_order_release);
+        ++m_head;
+        m_head_pub.store(m_head, memory_order_release);
+        return true;
+    }
+
+    int drain(vector<T> &items, int max_items)
+    {
+        int n = 0;
+        while (n < max_items)
+        {
+            slot *s = &m_slots[m_head & m_mask];
+            if (s->seq.load(memory_order_acquire) != m_head + 1)
+                break;
+            items.push_back(std::move(s->data));
+            s->seq.store(m_head + m_capacity, memory_order_release);
+            ++m_head;
+            ++n;
+        }
+        if (n)
+            m_head_pub.store(m_head, memory_order_release);
+        return n;
+    }
+
+    bool has_data()
+    {
+        return m_slots[m_head & m_mask].seq.load(memory_order_acquire) == m_head + 1;
+    }
+
+    //队列为空时休眠，返回false表示超时或队列已关闭
+    bool wait_nonempty(int ms_timeout)
+    {
+        struct timespec t = {0, 0};
+        if (ms_timeout >= 0)
+        {
+            struct timeval now = {0, 0};
+            gettimeofday(&now, NULL);
+            long nsec = now.tv_usec * 1000L + (ms_timeout % 1000) * 1000000L;
+            t.tv_sec = now.tv_sec + ms_timeout / 1000 + nsec / 1000000000L;
+            t.tv_nsec = nsec % 1000000000L;
+        }
+
+        bool ret = true;
+        m_sleeping.store(true);
+        atomic_thread_fence(memory_order_seq_cst);
+        m_mutex.lock();
+        while (!has_data())
+        {
+            if (m_closed.load())
+            {
+                ret = false;
+                break;
+            }
+            if (ms_timeout < 0)
+                m_cond.wait(m_mutex.get());
+            else if (!m_cond.timewait(m_mutex.get(), t))
+            {
+                ret = has_data();
+                break;
+            }
+        }
+        m_mutex.unlock();
+        m_sleeping.store(false, memory_order_relaxed);
+        return ret;
+    }
+
+private:
+    slot *m_slots;
+    size_t m_capacity;
+    size_t m_mask;
+
+    alignas(64) atomic<size_t> m_tail;      //生产者竞争的写位置
+    alignas(64) size_t m_head;              //消费者私有的读位置
+    atomic<size_t> m_head_pub;              //对外发布的读位置，用于size()
+    atomic<bool> m_sleeping;                //消费者是否在条件变量上休眠
+    atomic<bool> m_closed;
+
+    locker m_mutex;
+    cond m_cond;
+};
+
+#endif
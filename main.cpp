@@ -15,19 +15,34 @@ int main(int argc, char *argv[])
 
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
-                config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.sql_min_num, config.user_flush_ms, config.store_backend, config.session_ttl, config.thread_num, 
+                config.close_log, config.actor_model, config.access_sample, config.access_slow_ms,
+                config.capture_mb, config.event_engine, config.backlog, config.defer_accept,
+                config.overload_ms, config.ip_conn_limit, config.ip_rate, config.drain_timeout, config.cpus,
+                config.header_timeout, config.body_rate, config.write_timeout, config.idle_timeout);
     
 
+    //信号屏蔽，之后创建的线程都继承
+    server.block_signals();
+
     //日志
     server.log_write();
 
+    //CPU绑定与连接对象分配
+    server.cpu_affinity();
+
     //数据库
     server.sql_pool();
 
+    //登录会话
+    server.session();
+
     //线程池
     server.thread_pool();
 
+    //运行指标
+    server.metrics();
+
     //触发模式
     server.trig_mode();
 
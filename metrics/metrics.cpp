@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include "metrics.h"
+
+//同名计数器连续排列，导出时只输出一次HELP/TYPE
+static const struct
+{
+    const char *name;
+    const char *labels;
+    const char *help;
+} counter_desc[COUNTER_NUM] = {
+    {"webserver_accepts_total", "", "Accepted connections."},
+    {"webserver_timeouts_total", "", "Inactive connections closed by the timer."},
+    {"webserver_responses_total", "code=\"2xx\"", "Responses sent, by status class."},
+    {"webserver_responses_total", "code=\"4xx\"", "Responses sent, by status class."},
+    {"webserver_responses_total", "code=\"5xx\"", "Responses sent, by status class."},
+    {"webserver_write_errors_total", "", "Responses aborted by a write error."},
+    {"webserver_sent_bytes_total", "", "Bytes written to clients."},
+    {"webserver_sql_tasks_total", "", "Tasks submitted to the DB executor."},
+    {"webserver_shed_total", "reason=\"queue_delay\"", "Requests rejected with 503 by overload control, by reason."},
+    {"webserver_shed_total", "reason=\"queue_full\"", "Requests rejected with 503 by overload control, by reason."},
+    {"webserver_shed_total", "reason=\"ip_conn\"", "Requests rejected with 503 by overload control, by reason."},
+    {"webserver_shed_total", "reason=\"ip_rate\"", "Requests rejected with 503 by overload control, by reason."},
+    {"webserver_shed_total", "reason=\"max_fd\"", "Requests rejected with 503 by overload control, by reason."},
+    {"webserver_rx_cpu_remote_total", "", "Accepted connections received on a CPU other than the main loop's."},
+};
+
+static const char *stage_names[HISTOGRAM_NUM] = {"accept", "read", "queue", "parse", "handle", "write", "total"};
+
+//导出的累计分桶上界为2^0..2^EXPORT_BITS微秒
+static const int EXPORT_BITS = 26;
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+int Metrics::bucket_of(long long v)
+{
+    if (v < SUB_NUM)
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    if (e >= MAX_BITS)
+        return BUCKET_NUM - 1;
+    return (e - SUB_BITS + 1) * SUB_NUM + ((v >> (e - SUB_BITS)) & (SUB_NUM - 1));
+}
+
+long long Metrics::bucket_upper(int b)
+{
+    if (b < SUB_NUM)
+        return b + 1;
+    int group = b / SUB_NUM;
+    return (long long)(SUB_NUM + b % SUB_NUM + 1) << (group - 1);
+}
+
+Metrics::slot *Metrics::new_slot()
+{
+    slot *s = new slot;
+    for (int i = 0; i < COUNTER_NUM; ++i)
+        s->counters[i].store(0, memory_order_relaxed);
+    for (int i = 0; i < HISTOGRAM_NUM; ++i)
+    {
+        s->sums[i].store(0, memory_order_relaxed);
+        for (int j = 0; j < BUCKET_NUM; ++j)
+            s->buckets[i][j].store(0, memory_order_relaxed);
+    }
+    m_lock.lock();
+    m_slots.push_back(s);
+    m_lock.unlock();
+    return s;
+}
+
+void Metrics::add_gauge(const char *name, const char *help, long (*fn)(void *), void *arg)
+{
+    gauge g = {name, help, fn, arg};
+    m_lock.lock();
+    m_gauges.push_back(g);
+    m_lock.unlock();
+}
+
+static void append(string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len > 0)
+        out.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+void Metrics::render(string &out)
+{
+    long long counters[COUNTER_NUM] = {0};
+    long long sums[HISTOGRAM_NUM] = {0};
+    vector<long long> buckets(HISTOGRAM_NUM * BUCKET_NUM, 0);
+    vector<gauge> gauges;
+
+    m_lock.lock();
+    for (size_t i = 0; i < m_slots.size(); ++i)
+    {
+        slot *s = m_slots[i];
+        for (int c = 0; c < COUNTER_NUM; ++c)
+            counters[c] += s->counters[c].load(memory_order_relaxed);
+        for (int h = 0; h < HISTOGRAM_NUM; ++h)
+        {
+            sums[h] += s->sums[h].load(memory_order_relaxed);
+            for (int b = 0; b < BUCKET_NUM; ++b)
+                buckets[h * BUCKET_NUM + b] += s->buckets[h][b].load(memory_order_relaxed);
+        }
+    }
+    gauges = m_gauges;
+    m_lock.unlock();
+
+    out.clear();
+    for (int c = 0; c < COUNTER_NUM; ++c)
+    {
+        const char *name = counter_desc[c].name;
+        if (c == 0 || strcmp(name, counter_desc[c - 1].name) != 0)
+            append(out, "# HELP %s %s\n# TYPE %s counter\n", name, counter_desc[c].help, name);
+        if (counter_desc[c].labels[0])
+            append(out, "%s{%s} %lld\n", name, counter_desc[c].labels, counters[c]);
+        else
+            append(out, "%s %lld\n", name, counters[c]);
+    }
+
+    for (size_t i = 0; i < gauges.size(); ++i)
+    {
+        append(out, "# HELP %s %s\n# TYPE %s gauge\n", gauges[i].name, gauges[i].help, gauges[i].name);
+        append(out, "%s %ld\n", gauges[i].name, gauges[i].fn(gauges[i].arg));
+    }
+
+    //各阶段直方图，累计分桶取2的幂为上界，与内部细分桶边界对齐
+    const char *hist = "webserver_stage_duration_seconds";
+    append(out, "# HELP %s Request latency by processing stage.\n# TYPE %s histogram\n", hist, hist);
+    for (int h = 0; h < HISTOGRAM_NUM; ++h)
+    {
+        const long long *hb = &buckets[h * BUCKET_NUM];
+        long long cum = 0;
+        int b = 0;
+        for (int k = 0; k <= EXPORT_BITS; ++k)
+        {
+            for (; b < BUCKET_NUM && bucket_upper(b) <= (1LL << k); ++b)
+                cum += hb[b];
+            append(out, "%s_bucket{stage=\"%s\",le=\"%g\"} %lld\n", hist, stage_names[h], (double)(1LL << k) / 1e6, cum);
+        }
+        for (; b < BUCKET_NUM; ++b)
+            cum += hb[b];
+        append(out, "%s_bucket{stage=\"%s\",le=\"+Inf\"} %lld\n", hist, stage_names[h], cum);
+        append(out, "%s_sum{stage=\"%s\"} %g\n", hist, stage_names[h], sums[h] / 1e6);
+        append(out, "%s_count{stage=\"%s\"} %lld\n", hist, stage_names[h], cum);
+    }
+
+    //由细分桶估算的分位数，取所在桶的上界
+    const char *quant = "webserver_stage_duration_quantile_seconds";
+    append(out, "# HELP %s Latency quantiles since start, from fine-grained buckets.\n# TYPE %s gauge\n", quant, quant);
+    for (int h = 0; h < HISTOGRAM_NUM; ++h)
+    {
+        const long long *hb = &buckets[h * BUCKET_NUM];
+        long long total = 0;
+        for (int b = 0; b < BUCKET_NUM; ++b)
+            total += hb[b];
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+        {
+            long long rank = (long long)(quantiles[q] * total + 0.5);
+            long long cum = 0;
+            int b = 0;
+            for (; b < BUCKET_NUM - 1; ++b)
+            {
+                cum += hb[b];
+                if (cum >= rank && cum > 0)
+                    break;
+            }
+            double v = total ? bucket_upper(b) / 1e6 : 0;
+            append(out, "%s{stage=\"%s\",quantile=\"%g\"} %g\n", quant, stage_names[h], quantiles[q], v);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include "../lock/locker.h"
+
+using namespace std;
+
+//计数器编号，名称和说明见metrics.cpp中的counter_desc
+enum counter_id
+{
+    C_ACCEPTS = 0,      //建立的连接
+    C_TIMEOUTS,         //定时器关闭的非活动连接
+    C_RESPONSES_2XX,    //按状态码分类的响应
+    C_RESPONSES_4XX,
+    C_RESPONSES_5XX,
+    C_WRITE_ERRORS,     //发送失败
+    C_BYTES_SENT,       //发送字节数
+    C_SQL_TASKS,        //提交到数据库执行器的任务
+    C_SHED_QUEUE,       //按原因分类的过载拒绝
+    C_SHED_QUEUE_FULL,
+    C_SHED_IP_CONN,
+    C_SHED_IP_RATE,
+    C_SHED_MAX_FD,
+    C_RX_CPU_REMOTE,    //收包CPU与主循环CPU不一致的连接
+    COUNTER_NUM
+};
+
+//延迟直方图编号，单位微秒
+enum histogram_id
+{
+    H_ACCEPT = 0,   //accept到读到首字节(连接上的第一个请求)
+    H_READ,         //首字节到收齐请求
+    H_QUEUE,        //请求队列中等待
+    H_PARSE,        //解析请求
+    H_HANDLE,       //生成响应(含数据库等待)
+    H_WRITE,        //发送响应
+    H_TOTAL,        //首字节(或入队)到发送完成
+    HISTOGRAM_NUM
+};
+
+//运行指标
+//计数器和直方图按线程分槽，每个线程只写自己的槽(无原子读改写、无锁、无伪共享)，
+//导出时汇总所有槽；直方图为对数线性分桶(每个2的幂区间再等分8份)，相对误差不超过12.5%
+//瞬时值(连接数、队列长度等)由各模块注册回调，导出时调用
+class Metrics
+{
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB_NUM = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;    //超过2^40微秒的值计入最后一个桶
+    static const int BUCKET_NUM = (MAX_BITS - SUB_BITS + 1) * SUB_NUM;
+
+    static Metrics *get_instance()
+    {
+        static Metrics instance;
+        return &instance;
+    }
+
+    void inc(counter_id id, long long n = 1)
+    {
+        slot *s = local();
+        s->counters[id].store(s->counters[id].load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    void observe(histogram_id id, long long us)
+    {
+        slot *s = local();
+        atomic<long long> &b = s->buckets[id][bucket_of(us < 0 ? 0 : us)];
+        b.store(b.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        s->sums[id].store(s->sums[id].load(memory_order_relaxed) + us, memory_order_relaxed);
+    }
+
+    //注册瞬时值，fn在导出线程中调用
+    void add_gauge(const char *name, const char *help, long (*fn)(void *), void *arg);
+
+    //以Prometheus文本格式导出
+    void render(string &out);
+
+    static int bucket_of(long long v);
+    //桶的上界(不含)
+    static long long bucket_upper(int b);
+
+private:
+    Metrics() {}
+    ~Metrics() {}
+
+    struct alignas(64) slot
+    {
+        atomic<long long> counters[COUNTER_NUM];
+        atomic<long long> sums[HISTOGRAM_NUM];
+        atomic<long long> buckets[HISTOGRAM_NUM][BUCKET_NUM];
+    };
+    struct gauge
+    {
+        const char *name;
+        const char *help;
+        long (*fn)(void *);
+        void *arg;
+    };
+
+    //当前线程的槽，首次使用时分配并登记，线程退出后保留以免丢失计数
+    slot *local()
+    {
+        static thread_local slot *t_slot = NULL;
+        if (!t_slot)
+            t_slot = new_slot();
+        return t_slot;
+    }
+    slot *new_slot();
+
+    locker m_lock;
+    vector<slot *> m_slots;
+    vector<gauge> m_gauges;
+};
+
+#endif
@@ -0,0 +1,440 @@
+//基于epoll的HTTP压测工具
+//多线程，每个线程一个epoll实例管理若干连接；支持长连接、管线化、GET/登录POST混合、
+//闭环(每个连接收到响应后立即发下一个)与开环(按固定速率发送)两种模式，输出延迟分位数
+//开环模式下延迟从计划发送时刻算起，服务器变慢导致的发送推迟也计入延迟，避免协调遗漏
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+struct options
+{
+    const char *host;
+    int port;
+    int connections;
+    int threads;
+    int duration;
+    bool keep_alive;
+    int pipeline;
+    double rate;            //总请求速率，0为闭环
+    int login_pct;          //登录POST占比
+    const char *user;
+    const char *passwd;
+    vector<string> paths;
+    int timeout_ms;         //连接无进展超过该时间视为失败并重连
+};
+
+static options g_opt;
+static sockaddr_in g_addr;
+static vector<string> g_get_reqs;
+static string g_login_req;
+static atomic<bool> g_stop(false);
+
+struct conn
+{
+    int fd;
+    bool connecting;
+    string out;                 //待发送
+    size_t out_off;
+    string in;                  //已接收未解析
+    deque<long long> inflight;  //已发送请求的起始时刻
+    long long next_send;        //开环模式下一个请求的计划时刻
+    long long last_progress;
+};
+
+struct worker_stat
+{
+    long long requests;
+    long long errors;
+    long long bytes;
+    long long status_err;   //非2xx响应
+    long long connects;
+    vector<unsigned int> latencies;
+};
+
+struct worker
+{
+    pthread_t tid;
+    int id;
+    int nconn;
+    double rate;            //本线程每个连接的速率
+    unsigned int seed;
+    worker_stat stat;
+};
+
+static void build_requests()
+{
+    const char *conn_hdr = g_opt.keep_alive ? "keep-alive" : "close";
+    char buf[1024];
+    for (size_t i = 0; i < g_opt.paths.size(); ++i)
+    {
+        snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                 g_opt.paths[i].c_str(), g_opt.host, conn_hdr);
+        g_get_reqs.push_back(buf);
+    }
+    char body[256];
+    snprintf(body, sizeof(body), "user=%s&password=%s", g_opt.user, g_opt.passwd);
+    snprintf(buf, sizeof(buf), "POST /2CGISQL.cgi HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n"
+                               "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n%s",
+             g_opt.host, conn_hdr, strlen(body), body);
+    g_login_req = buf;
+}
+
+static const string &pick_request(worker *w)
+{
+    if (g_opt.login_pct > 0 && (int)(rand_r(&w->seed) % 100) < g_opt.login_pct)
+        return g_login_req;
+    return g_get_reqs[rand_r(&w->seed) % g_get_reqs.size()];
+}
+
+static bool open_conn(int epfd, conn &c, worker *w)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(c.fd, (sockaddr *)&g_addr, sizeof(g_addr));
+    if (ret < 0 && errno != EINPROGRESS)
+    {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.connecting = ret < 0;
+    c.out.clear();
+    c.out_off = 0;
+    c.in.clear();
+    c.last_progress = now_us();
+    ++w->stat.connects;
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = &c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+//连接出错或被关闭：未完成的请求计为错误
+static void close_conn(int epfd, conn &c, worker *w)
+{
+    if (c.fd >= 0)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+        c.fd = -1;
+    }
+    w->stat.errors += c.inflight.size();
+    c.inflight.clear();
+}
+
+//在管线深度允许时追加请求
+static void fill_pipeline(conn &c, worker *w, long long now)
+{
+    int depth = g_opt.keep_alive ? g_opt.pipeline : 1;
+    while ((int)c.inflight.size() < depth)
+    {
+        long long start = now;
+        if (w->rate > 0)
+        {
+            if (c.next_send > now)
+                break;
+            start = c.next_send;
+            c.next_send += (long long)(1000000.0 / w->rate);
+        }
+        c.out += pick_request(w);
+        c.inflight.push_back(start);
+    }
+}
+
+static bool flush_out(conn &c)
+{
+    while (c.out_off < c.out.size())
+    {
+        ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN;
+        c.out_off += n;
+    }
+    c.out.clear();
+    c.out_off = 0;
+    return true;
+}
+
+//解析已收到的完整响应，返回false表示报文错误
+static bool parse_responses(conn &c, worker *w, long long now)
+{
+    while (!c.inflight.empty())
+    {
+        size_t head_end = c.in.find("\r\n\r\n");
+        if (head_end == string::npos)
+            return true;
+        long len = 0;
+        const char *cl = strcasestr(c.in.c_str(), "\r\nContent-Length:");
+        if (cl && (size_t)(cl - c.in.c_str()) < head_end)
+            len = atol(cl + 17);
+        size_t total = head_end + 4 + len;
+        if (c.in.size() < total)
+            return true;
+
+        int status = 0;
+        if (sscanf(c.in.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+            return false;
+        if (status < 200 || status >= 300)
+            ++w->stat.status_err;
+        ++w->stat.requests;
+        w->stat.bytes += total;
+        long long lat = now - c.inflight.front();
+        w->stat.latencies.push_back(lat > 0xffffffffLL ? 0xffffffffu : (unsigned int)lat);
+        c.inflight.pop_front();
+        c.in.erase(0, total);
+    }
+    return true;
+}
+
+static void *run_worker(void *arg)
+{
+    worker *w = (worker *)arg;
+    int epfd = epoll_create1(0);
+    vector<conn> conns(w->nconn);
+    long long start = now_us();
+    for (int i = 0; i < w->nconn; ++i)
+    {
+        conns[i].fd = -1;
+        //开环模式下各连接错开发送时刻
+        conns[i].next_send = start + (w->rate > 0 ? (long long)(1000000.0 / w->rate * i / w->nconn) : 0);
+        open_conn(epfd, conns[i], w);
+    }
+
+    vector<epoll_event> events(w->nconn + 1);
+    char buf[65536];
+    while (!g_stop.load(memory_order_relaxed))
+    {
+        long long now = now_us();
+        for (int i = 0; i < w->nconn; ++i)
+        {
+            conn &c = conns[i];
+            if (c.fd < 0 && !open_conn(epfd, c, w))
+                continue;
+            if (!c.connecting)
+            {
+                fill_pipeline(c, w, now);
+                if (!flush_out(c))
+                    close_conn(epfd, c, w);
+            }
+            if (c.fd >= 0 && now - c.last_progress > g_opt.timeout_ms * 1000LL && (c.connecting || !c.inflight.empty()))
+                close_conn(epfd, c, w);
+        }
+
+        int n = epoll_wait(epfd, &events[0], events.size(), w->rate > 0 ? 1 : 10);
+        now = now_us();
+        for (int i = 0; i < n; ++i)
+        {
+            conn &c = *(conn *)events[i].data.ptr;
+            if (c.fd < 0)
+                continue;
+            if (c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err)
+                {
+                    close_conn(epfd, c, w);
+                    ++w->stat.errors;
+                    continue;
+                }
+                c.connecting = false;
+                c.last_progress = now;
+                fill_pipeline(c, w, now);
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                if (!flush_out(c))
+                {
+                    close_conn(epfd, c, w);
+                    continue;
+                }
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                bool closed = false;
+                while (true)
+                {
+                    ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+                    if (r > 0)
+                    {
+                        c.in.append(buf, r);
+                        c.last_progress = now;
+                        continue;
+                    }
+                    closed = r == 0 || errno != EAGAIN;
+                    break;
+                }
+                if (!parse_responses(c, w, now))
+                    closed = true;
+                //短连接收完响应后由服务器关闭，重新建立
+                if (closed || (!g_opt.keep_alive && c.inflight.empty()))
+                    close_conn(epfd, c, w);
+            }
+        }
+    }
+
+    for (int i = 0; i < w->nconn; ++i)
+    {
+        if (conns[i].fd >= 0)
+            close(conns[i].fd);
+    }
+    close(epfd);
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-c connections] [-t threads] [-d seconds]\n"
+            "          [-k 0|1] [-P pipeline] [-r rate] [-g path]... [-l login_pct] [-U user] [-W passwd] [-o timeout_ms]\n"
+            "  -k  keep-alive, default 1; with -k 0 every request opens a new connection\n"
+            "  -P  requests in flight per keep-alive connection, default 1\n"
+            "  -r  open-loop total requests/s, default 0 (closed loop)\n"
+            "  -g  GET path, repeatable, default /\n"
+            "  -l  percentage of login POSTs to /2CGISQL.cgi, default 0\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    g_opt.host = "127.0.0.1";
+    g_opt.port = 9006;
+    g_opt.connections = 100;
+    g_opt.threads = 2;
+    g_opt.duration = 10;
+    g_opt.keep_alive = true;
+    g_opt.pipeline = 1;
+    g_opt.rate = 0;
+    g_opt.login_pct = 0;
+    g_opt.user = "test";
+    g_opt.passwd = "test";
+    g_opt.timeout_ms = 5000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:t:d:k:P:r:g:l:U:W:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': g_opt.host = optarg; break;
+        case 'p': g_opt.port = atoi(optarg); break;
+        case 'c': g_opt.connections = atoi(optarg); break;
+        case 't': g_opt.threads = atoi(optarg); break;
+        case 'd': g_opt.duration = atoi(optarg); break;
+        case 'k': g_opt.keep_alive = atoi(optarg) != 0; break;
+        case 'P': g_opt.pipeline = atoi(optarg); break;
+        case 'r': g_opt.rate = atof(optarg); break;
+        case 'g': g_opt.paths.push_back(optarg); break;
+        case 'l': g_opt.login_pct = atoi(optarg); break;
+        case 'U': g_opt.user = optarg; break;
+        case 'W': g_opt.passwd = optarg; break;
+        case 'o': g_opt.timeout_ms = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (g_opt.connections <= 0 || g_opt.threads <= 0 || g_opt.pipeline <= 0 || g_opt.duration <= 0)
+        usage(argv[0]);
+    if (g_opt.threads > g_opt.connections)
+        g_opt.threads = g_opt.connections;
+    if (g_opt.paths.empty())
+        g_opt.paths.push_back("/");
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_opt.port);
+    if (inet_pton(AF_INET, g_opt.host, &g_addr.sin_addr) != 1)
+    {
+        hostent *he = gethostbyname(g_opt.host);
+        if (!he)
+        {
+            fprintf(stderr, "unknown host %s\n", g_opt.host);
+            return 1;
+        }
+        memcpy(&g_addr.sin_addr, he->h_addr, sizeof(g_addr.sin_addr));
+    }
+    signal(SIGPIPE, SIG_IGN);
+    build_requests();
+
+    vector<worker> workers(g_opt.threads);
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        worker &w = workers[i];
+        w.id = i;
+        w.nconn = g_opt.connections / g_opt.threads + (i < g_opt.connections % g_opt.threads ? 1 : 0);
+        w.rate = g_opt.rate > 0 ? g_opt.rate / g_opt.connections : 0;
+        w.seed = 12345 + i;
+        w.stat.requests = w.stat.errors = w.stat.bytes = w.stat.status_err = w.stat.connects = 0;
+    }
+    long long begin = now_us();
+    for (int i = 0; i < g_opt.threads; ++i)
+        pthread_create(&workers[i].tid, NULL, run_worker, &workers[i]);
+    sleep(g_opt.duration);
+    g_stop = true;
+    worker_stat total = {0, 0, 0, 0, 0, vector<unsigned int>()};
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        pthread_join(workers[i].tid, NULL);
+        worker_stat &s = workers[i].stat;
+        total.requests += s.requests;
+        total.errors += s.errors;
+        total.bytes += s.bytes;
+        total.status_err += s.status_err;
+        total.connects += s.connects;
+        total.latencies.insert(total.latencies.end(), s.latencies.begin(), s.latencies.end());
+    }
+    double secs = (now_us() - begin) / 1e6;
+
+    printf("%s:%d  %d connections  %d threads  %ds  keep-alive %d  pipeline %d  %s\n",
+           g_opt.host, g_opt.port, g_opt.connections, g_opt.threads, g_opt.duration,
+           g_opt.keep_alive ? 1 : 0, g_opt.pipeline,
+           g_opt.rate > 0 ? "open loop" : "closed loop");
+    printf("requests   %lld (%.1f/s)  non-2xx %lld  errors %lld  connects %lld\n",
+           total.requests, total.requests / secs, total.status_err, total.errors, total.connects);
+    printf("transfer   %.2f MB/s\n", total.bytes / secs / 1048576.0);
+
+    vector<unsigned int> &lat = total.latencies;
+    if (lat.empty())
+    {
+        printf("latency    no responses\n");
+        return 1;
+    }
+    sort(lat.begin(), lat.end());
+    const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    printf("latency(us)");
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); ++i)
+        printf("  p%g %u", qs[i] * 100, lat[min(lat.size() - 1, (size_t)(qs[i] * lat.size()))]);
+    printf("  max %u\n", lat.back());
+    return 0;
+}
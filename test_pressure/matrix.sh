@@ -0,0 +1,101 @@
+#!/bin/bash
+# 按配置矩阵逐个启动服务器，用loadgen施加固定负载，汇总吞吐、延迟分位数、CPU与内存
+# 用法: test_pressure/matrix.sh        (在仓库根目录或任意目录执行)
+# 各维度可用环境变量覆盖，取值以空格分隔，例如
+#   TRIG="0 3" ACTOR="0" THREADS="4 8" test_pressure/matrix.sh
+
+TRIG=${TRIG:-"0 1 2 3"}         #-m 触发组合
+ACTOR=${ACTOR:-"0 1"}           #-a 0 proactor 1 reactor
+THREADS=${THREADS:-"8"}         #-t 线程池线程数
+SQL=${SQL:-"8"}                 #-s 连接池大小，内存后端下不建连接
+CLOSE_LOG=${CLOSE_LOG:-"1"}     #-c 1 关闭日志
+LOGWRITE=${LOGWRITE:-"0"}       #-l 0 同步 1 异步，仅在日志打开时有意义
+
+PORT=${PORT:-9106}
+CONNS=${CONNS:-200}             #loadgen连接数
+LG_THREADS=${LG_THREADS:-4}     #loadgen线程数
+DURATION=${DURATION:-10}        #每个配置的施压秒数
+KEEP_ALIVE=${KEEP_ALIVE:-1}
+LOGIN_PCT=${LOGIN_PCT:-10}      #登录POST占比，其余为GET /
+OUT=${OUT:-/tmp/webserver_matrix}
+
+DIR=$(cd "$(dirname "$0")/.." && pwd)
+SERVER=$DIR/server
+LOADGEN=$DIR/test_pressure/loadgen/loadgen
+HZ=$(getconf CLK_TCK)
+
+if [ ! -x "$SERVER" ] || [ ! -x "$LOADGEN" ]; then
+    echo "build first: make server && make -C test_pressure/loadgen" >&2
+    exit 1
+fi
+
+#服务器在临时目录中运行，日志不落在仓库里；root目录用符号链接
+mkdir -p "$OUT"
+WORK=$(mktemp -d)
+ln -s "$DIR/root" "$WORK/root"
+trap 'rm -rf "$WORK"' EXIT
+
+#进程累计CPU时间(时钟滴答)
+cpu_ticks() {
+    awk '{ print $14 + $15 }' /proc/$1/stat
+}
+
+#内存峰值(KB)
+rss_peak() {
+    awk '/^VmHWM/ { print $2 }' /proc/$1/status
+}
+
+wait_port() {
+    for i in $(seq 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+run_one() {
+    local m=$1 a=$2 t=$3 s=$4 c=$5 l=$6
+    local name="m${m}_a${a}_t${t}_s${s}_c${c}_l${l}"
+
+    #内存后端，与数据库无关；用户数据每次从空开始
+    (cd "$WORK" && exec "$SERVER" -p $PORT -m $m -a $a -t $t -s $s -c $c -l $l -b 2 \
+        > "$OUT/$name.server" 2>&1) &
+    local pid=$!
+    if ! wait_port; then
+        echo "$name: server did not start, see $OUT/$name.server" >&2
+        kill $pid 2>/dev/null; wait $pid 2>/dev/null
+        return
+    fi
+    curl -s -o /dev/null -d "user=bench&password=bench" http://127.0.0.1:$PORT/3CGISQL.cgi
+
+    local c0=$(cpu_ticks $pid) t0=$(date +%s.%N)
+    "$LOADGEN" -p $PORT -c $CONNS -t $LG_THREADS -d $DURATION -k $KEEP_ALIVE \
+        -l $LOGIN_PCT -U bench -W bench -g / > "$OUT/$name.loadgen" 2>&1
+    local c1=$(cpu_ticks $pid) t1=$(date +%s.%N)
+    local rss=$(rss_peak $pid)
+
+    kill $pid; wait $pid 2>/dev/null
+
+    #loadgen输出: requests N (R/s) non-2xx X errors E ...; latency(us) p50 A p90 B p99 C p99.9 D max M
+    awk -v name="$m $a $t $s $c $l" -v ticks=$((c1 - c0)) -v hz=$HZ -v t0=$t0 -v t1=$t1 -v rss="$rss" '
+        /^requests/ { gsub(/[()\/s]/, "", $3); rps = $3; bad = $5 + $7 }
+        /^latency\(us\)/ { p50 = $3; p99 = $7; p999 = $9; max = $11 }
+        END {
+            cpu = ticks / hz / (t1 - t0) * 100
+            printf "%-14s %10.0f %8s %8s %8s %8s %7.0f %8.1f %6d\n", name, rps, p50, p99, p999, max, cpu, rss / 1024, bad
+        }
+    ' "$OUT/$name.loadgen"
+}
+
+{
+printf "%-14s %10s %8s %8s %8s %8s %7s %8s %6s\n" "m a t s c l" "req/s" "p50us" "p99us" "p99.9us" "maxus" "cpu%" "rssMB" "bad"
+for m in $TRIG; do
+for a in $ACTOR; do
+for t in $THREADS; do
+for s in $SQL; do
+for c in $CLOSE_LOG; do
+for l in $LOGWRITE; do
+    run_one $m $a $t $s $c $l
+done; done; done; done; done; done
+} | tee "$OUT/summary.txt"
+echo "raw output in $OUT"
@@ -0,0 +1,22 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+//微基准公共部分：计时与统一的输出格式
+#include <stdio.h>
+#include <time.h>
+
+static inline double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//name为基准名，ops为操作次数，secs为总耗时
+static inline void report(const char *name, double ops, double secs, const char *note = "")
+{
+    printf("%-36s %10.1f ns/op %14.0f ops/sec  %s\n", name, secs * 1e9 / ops, ops / secs, note);
+    fflush(stdout);
+}
+
+#endif
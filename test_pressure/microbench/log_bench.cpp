@@ -0,0 +1,70 @@
+//日志微基准：多个线程并发调用Log::write_log
+//同步模式测得的是格式化+加锁fputs的耗时；异步模式测得的是调用方看到的耗时(格式化+入队)，
+//写文件由日志线程完成。Log是单例，每种模式在单独的子进程中运行
+//用法: ./log_bench [线程数] [每线程条数] [日志目录]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <vector>
+#include "../../log/log.h"
+#include "bench.h"
+
+using namespace std;
+
+static int g_per_thread;
+
+static void *writer(void *)
+{
+    Log *log = Log::get_instance();
+    for (int i = 0; i < g_per_thread; ++i)
+        log->write_log(1, "deal with the client(%s) fd %d request %d", "127.0.0.1", 42, i);
+    return NULL;
+}
+
+static void run(const char *name, const char *file, int threads, int queue_size)
+{
+    Log::get_instance()->init(file, 0, 2000, 800000, queue_size);
+    vector<pthread_t> tids(threads);
+    double start = now_sec();
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&tids[i], NULL, writer, NULL);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    double cost = now_sec() - start;
+
+    char note[64];
+    snprintf(note, sizeof(note), "threads=%d", threads);
+    report(name, (double)threads * g_per_thread, cost, note);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    g_per_thread = argc > 2 ? atoi(argv[2]) : 200000;
+    const char *dir = argc > 3 ? argv[3] : "/tmp";
+
+    char sync_file[256], async_file[256];
+    snprintf(sync_file, sizeof(sync_file), "%s/microbench_sync_log", dir);
+    snprintf(async_file, sizeof(async_file), "%s/microbench_async_log", dir);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        run("Log::write_log sync", sync_file, threads, 0);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+
+    pid = fork();
+    if (pid == 0)
+    {
+        run("Log::write_log async", async_file, threads, 8192);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    return 0;
+}
@@ -0,0 +1,160 @@
+//http解析微基准：对录制的请求报文反复执行parse_line与process_read
+//process_read解析完成后会进入do_request，这里把doc_root指向不存在的目录，只多一次失败的stat
+//开始前先检查空文件的响应报文，只能有一个状态行
+//用法: ./parse_bench [每种报文的迭代次数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <deque>
+#include <atomic>
+#include <utility>
+#include <unordered_map>
+#include <exception>
+//基准需要直接调用私有的状态机函数
+#define private public
+#include "../../http/http_conn.h"
+#undef private
+#include "bench.h"
+
+using namespace std;
+
+struct sample
+{
+    const char *name;
+    const char *raw;
+};
+
+//curl、浏览器与登录表单的请求
+static const sample samples[] = {
+    {"curl GET",
+     "GET /judge.html HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "User-Agent: curl/8.5.0\r\n"
+     "Accept: */*\r\n"
+     "\r\n"},
+    {"browser GET keep-alive",
+     "GET /picture.html HTTP/1.1\r\n"
+     "Host: 192.168.1.10:9006\r\n"
+     "Connection: keep-alive\r\n"
+     "Cache-Control: max-age=0\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+     "Referer: http://192.168.1.10:9006/welcome.html\r\n"
+     "Accept-Encoding: gzip, deflate\r\n"
+     "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+     "Cookie: sid=0123456789abcdef0123456789abcdef\r\n"
+     "\r\n"},
+    {"login POST",
+     "POST /2CGISQL.cgi HTTP/1.1\r\n"
+     "Host: 127.0.0.1:9006\r\n"
+     "Connection: keep-alive\r\n"
+     "Content-Type: application/x-www-form-urlencoded\r\n"
+     "Content-Length: 25\r\n"
+     "\r\n"
+     "user=alice&password=12345"},
+};
+
+static char doc_root[] = "/nonexistent-microbench-root";
+
+static void load(http_conn &conn, const char *raw, size_t len)
+{
+    conn.init();
+    memcpy(conn.m_read_buf, raw, len);
+    conn.m_read_idx = len;
+}
+
+//在临时目录中放一个空文件，检查其响应只有一个状态行，且待发送长度与报文一致
+static bool check_empty_file(http_conn &conn)
+{
+    char dir[] = "/tmp/parse_bench_XXXXXX";
+    if (!mkdtemp(dir))
+        return false;
+    string file = string(dir) + "/empty.html";
+    FILE *fp = fopen(file.c_str(), "w");
+    if (!fp)
+        return false;
+    fclose(fp);
+    chmod(file.c_str(), 0644);
+
+    const char *raw = "GET /empty.html HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    char *saved_root = conn.doc_root;
+    conn.doc_root = dir;
+    load(conn, raw, strlen(raw));
+    http_conn::HTTP_CODE ret = conn.process_read();
+    bool ok = ret == http_conn::FILE_REQUEST && conn.process_write(ret);
+    if (ok)
+    {
+        string reply(conn.m_write_buf, conn.m_write_idx);
+        ok = reply.find("HTTP/1.1") == 0 && reply.find("HTTP/1.1", 1) == string::npos &&
+             conn.m_iv_count == 1 && conn.bytes_to_send == conn.m_write_idx;
+        if (!ok)
+            fprintf(stderr, "bad reply for empty file:\n%s\n", reply.c_str());
+    }
+    else
+    {
+        fprintf(stderr, "empty file request failed, result %d\n", ret);
+    }
+    conn.unmap();
+    conn.doc_root = saved_root;
+    unlink(file.c_str());
+    rmdir(dir);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int iters = argc > 1 ? atoi(argv[1]) : 200000;
+    http_conn *conn = new http_conn;
+    conn->doc_root = doc_root;
+    conn->m_close_log = 1;
+    conn->m_TRIGMode = 0;
+
+    if (!check_empty_file(*conn))
+        return 1;
+
+    printf("iterations=%d\n", iters);
+    for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); ++s)
+    {
+        const char *raw = samples[s].raw;
+        size_t len = strlen(raw);
+        char name[64];
+
+        //从状态机：逐行切分，不含主状态机
+        long lines = 0;
+        double start = now_sec();
+        for (int i = 0; i < iters; ++i)
+        {
+            memcpy(conn->m_read_buf, raw, len);
+            conn->m_read_idx = len;
+            conn->m_checked_idx = 0;
+            while (conn->parse_line() == http_conn::LINE_OK)
+                ++lines;
+        }
+        snprintf(name, sizeof(name), "parse_line %s", samples[s].name);
+        report(name, iters, now_sec() - start, "");
+
+        //完整的process_read，含init重置缓冲区
+        http_conn::HTTP_CODE ret = http_conn::NO_REQUEST;
+        start = now_sec();
+        for (int i = 0; i < iters; ++i)
+        {
+            load(*conn, raw, len);
+            ret = conn->process_read();
+        }
+        snprintf(name, sizeof(name), "process_read %s", samples[s].name);
+        char note[64];
+        snprintf(note, sizeof(note), "result=%d bytes=%zu", ret, len);
+        report(name, iters, now_sec() - start, note);
+        if (ret == http_conn::BAD_REQUEST || ret == http_conn::NO_REQUEST)
+        {
+            fprintf(stderr, "unexpected parse result %d for %s\n", ret, samples[s].name);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+//数据库连接池微基准：多个线程并发GetConnection/ReleaseConnection
+//需要可连接的MySQL，连不上时跳过
+//用法: ./pool_bench [host] [user] [passwd] [db] [连接数] [每线程次数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <vector>
+#include "../../CGImysql/sql_connection_pool.h"
+#include "bench.h"
+
+using namespace std;
+
+static int g_per_thread;
+
+static void *worker(void *)
+{
+    connection_pool *pool = connection_pool::GetInstance();
+    for (int i = 0; i < g_per_thread; ++i)
+    {
+        MYSQL *conn = pool->GetConnection();
+        pool->ReleaseConnection(conn);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = argc > 1 ? argv[1] : "localhost";
+    const char *user = argc > 2 ? argv[2] : "root";
+    const char *passwd = argc > 3 ? argv[3] : "123456";
+    const char *db = argc > 4 ? argv[4] : "yourdb";
+    int conns = argc > 5 ? atoi(argv[5]) : 8;
+    g_per_thread = argc > 6 ? atoi(argv[6]) : 100000;
+
+    connection_pool *pool = connection_pool::GetInstance();
+    if (!pool->init(host, user, passwd, db, 3306, conns, 1, conns) || pool->GetTotalConn() == 0)
+    {
+        printf("%-36s skipped: cannot connect to mysql://%s/%s\n", "connection_pool get/release", host, db);
+        return 0;
+    }
+
+    int threads[] = {1, conns, conns * 4};
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+    {
+        vector<pthread_t> tids(threads[t]);
+        double start = now_sec();
+        for (int i = 0; i < threads[t]; ++i)
+            pthread_create(&tids[i], NULL, worker, NULL);
+        for (int i = 0; i < threads[t]; ++i)
+            pthread_join(tids[i], NULL);
+        char name[64], note[64];
+        snprintf(name, sizeof(name), "connection_pool get/release t=%d", threads[t]);
+        snprintf(note, sizeof(note), "conns=%d", conns);
+        report(name, (double)threads[t] * g_per_thread, now_sec() - start, note);
+    }
+    pool->DestroyPool();
+    return 0;
+}
@@ -0,0 +1,117 @@
+//日志队列微基准：多个生产者线程并发push日志字符串，单个消费者取出
+//对比 block_queue::pop 逐条取出、block_queue::pop_batch 批量取出、mpsc_queue::pop_batch 无锁批量取出
+//用法: ./queue_bench [生产者线程数] [每线程条数] [队列长度]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+#include "../../log/block_queue.h"
+#include "../../log/mpsc_queue.h"
+#include "bench.h"
+
+using namespace std;
+
+static const int BATCH = 64;
+static const char *LINE = "2024-05-04 12:00:00.000000 [info]: deal with the client(127.0.0.1)\n";
+
+template <class Q>
+struct bench_ctx
+{
+    Q *queue;
+    int per_thread;
+    atomic<long> dropped;
+};
+
+//生产者：与Log::write_log一致，队列满时视为走同步路径(计入dropped)
+template <class Q>
+static void *producer(void *arg)
+{
+    bench_ctx<Q> *ctx = (bench_ctx<Q> *)arg;
+    for (int i = 0; i < ctx->per_thread; ++i)
+    {
+        string s(LINE);
+        while (!ctx->queue->push(std::move(s)))
+        {
+            ctx->dropped++;
+            s = LINE;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+//消费者逐条取出
+template <class Q>
+static long consume_single(Q &q, long total)
+{
+    string item;
+    long bytes = 0;
+    for (long i = 0; i < total; ++i)
+    {
+        q.pop(item);
+        bytes += item.size();
+    }
+    return bytes;
+}
+
+//消费者批量取出
+template <class Q>
+static long consume_batch(Q &q, long total)
+{
+    vector<string> items;
+    items.reserve(BATCH);
+    long bytes = 0, got = 0;
+    while (got < total)
+    {
+        int n = q.pop_batch(items, BATCH);
+        for (int i = 0; i < n; ++i)
+            bytes += items[i].size();
+        got += n;
+        items.clear();
+    }
+    return bytes;
+}
+
+template <class Q>
+static void run(const char *name, int producers, int per_thread, int qsize, bool batch)
+{
+    Q q(qsize);
+    bench_ctx<Q> ctx;
+    ctx.queue = &q;
+    ctx.per_thread = per_thread;
+    ctx.dropped = 0;
+
+    long total = (long)producers * per_thread;
+    vector<pthread_t> tids(producers);
+    double start = now_sec();
+    for (int i = 0; i < producers; ++i)
+        pthread_create(&tids[i], NULL, producer<Q>, &ctx);
+
+    long bytes = batch ? consume_batch(q, total) : consume_single(q, total);
+
+    for (int i = 0; i < producers; ++i)
+        pthread_join(tids[i], NULL);
+    double cost = now_sec() - start;
+
+    char note[64];
+    snprintf(note, sizeof(note), "full-retries=%ld bytes=%ld", ctx.dropped.load(), bytes);
+    report(name, total, cost, note);
+}
+
+int main(int argc, char *argv[])
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 8;
+    int per_thread = argc > 2 ? atoi(argv[2]) : 200000;
+    int qsize = argc > 3 ? atoi(argv[3]) : 800;
+
+    printf("producers=%d per_thread=%d queue=%d batch=%d\n", producers, per_thread, qsize, BATCH);
+    run<block_queue<string> >("block_queue pop", producers, per_thread, qsize, false);
+    run<block_queue<string> >("block_queue pop_batch", producers, per_thread, qsize, true);
+    run<mpsc_queue<string> >("mpsc_queue pop", producers, per_thread, qsize, false);
+    run<mpsc_queue<string> >("mpsc_queue pop_batch", producers, per_thread, qsize, true);
+    return 0;
+}
@@ -0,0 +1,64 @@
+//线程池微基准：主线程按Proactor方式append_p空任务，工作线程取出执行
+//测量入队+出队+唤醒的开销，队列满时主线程让出CPU重试
+//用法: ./threadpool_bench [任务数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include "../../threadpool/threadpool.h"
+#include "bench.h"
+
+using namespace std;
+
+static atomic<long> g_done(0);
+
+//与http_conn在线程池中用到的成员一致
+struct task
+{
+    int m_state;
+    int timer_flag;
+    long long m_t_enqueue;
+    long long m_t_dequeue;
+    void process() { g_done.fetch_add(1, memory_order_relaxed); }
+    bool read_once() { return true; }
+    bool write() { return true; }
+};
+
+static void run(int threads, long total)
+{
+    //线程为分离状态，基准进程退出时一并结束
+    threadpool<task> *pool = new threadpool<task>(0, threads);
+    vector<task> tasks(1024);
+    long retries = 0;
+    g_done = 0;
+
+    double start = now_sec();
+    for (long i = 0; i < total; ++i)
+    {
+        while (!pool->append_p(&tasks[i % tasks.size()]))
+        {
+            ++retries;
+            sched_yield();
+        }
+    }
+    while (g_done.load(memory_order_relaxed) < total)
+        sched_yield();
+    double cost = now_sec() - start;
+
+    char name[64], note[64];
+    snprintf(name, sizeof(name), "threadpool append_p threads=%d", threads);
+    snprintf(note, sizeof(note), "full-retries=%ld", retries);
+    report(name, total, cost, note);
+}
+
+int main(int argc, char *argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 1000000;
+    int threads[] = {1, 4, 8};
+    printf("tasks=%ld\n", total);
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i)
+        run(threads[i], total);
+    return 0;
+}
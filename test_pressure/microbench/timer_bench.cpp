@@ -0,0 +1,104 @@
+//定时器链表微基准：在1k~100k个定时器的升序链表上测add/adjust/del/tick
+//新连接与有数据传输的连接都会把超时设为当前时间+3*TIMESLOT，即插入到链表尾部，
+//这里按同样的模式测量，反映升序链表从头遍历的开销
+//用法: ./timer_bench [每项操作次数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../../timer/lst_timer.h"
+#include "bench.h"
+
+using namespace std;
+
+static void noop_cb(client_data *) {}
+
+static util_timer *make_timer(time_t expire, client_data *data)
+{
+    util_timer *t = new util_timer;
+    t->expire = expire;
+    t->cb_func = noop_cb;
+    t->user_data = data;
+    return t;
+}
+
+//按超时时间降序插入，每次都落在表头，O(1)建表
+static void build(sort_timer_lst &lst, vector<util_timer *> &timers, int n, time_t base, client_data *data)
+{
+    timers.resize(n);
+    for (int i = n - 1; i >= 0; --i)
+    {
+        timers[i] = make_timer(base + i, data);
+        lst.add_timer(timers[i]);
+    }
+}
+
+static void bench_size(int n, int ops)
+{
+    client_data data;
+    data.sockfd = -1;
+    char name[64];
+    time_t base = time(NULL) + 100000;
+
+    //add：插入到尾部，随后删除保持链表大小
+    {
+        sort_timer_lst lst;
+        vector<util_timer *> timers;
+        build(lst, timers, n, base, &data);
+        vector<util_timer *> added(ops);
+        double start = now_sec();
+        for (int i = 0; i < ops; ++i)
+        {
+            added[i] = make_timer(base + n + i, &data);
+            lst.add_timer(added[i]);
+        }
+        double cost = now_sec() - start;
+        snprintf(name, sizeof(name), "add_timer n=%d", n);
+        report(name, ops, cost, "");
+
+        start = now_sec();
+        for (int i = 0; i < ops; ++i)
+            lst.del_timer(added[i]);
+        snprintf(name, sizeof(name), "del_timer n=%d", n);
+        report(name, ops, now_sec() - start, "");
+    }
+
+    //adjust：随机选一个定时器延长到最大超时
+    {
+        sort_timer_lst lst;
+        vector<util_timer *> timers;
+        build(lst, timers, n, base, &data);
+        unsigned int seed = 1;
+        time_t expire = base + n;
+        double start = now_sec();
+        for (int i = 0; i < ops; ++i)
+        {
+            util_timer *t = timers[rand_r(&seed) % n];
+            t->expire = expire++;
+            lst.adjust_timer(t);
+        }
+        snprintf(name, sizeof(name), "adjust_timer n=%d", n);
+        report(name, ops, now_sec() - start, "");
+    }
+
+    //tick：全部到期，按每个定时器计
+    {
+        sort_timer_lst lst;
+        vector<util_timer *> timers;
+        build(lst, timers, n, 1, &data);
+        double start = now_sec();
+        lst.tick();
+        snprintf(name, sizeof(name), "tick expire n=%d", n);
+        report(name, n, now_sec() - start, "");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 1000;
+    int sizes[] = {1000, 10000, 100000};
+    printf("ops=%d\n", ops);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+        bench_size(sizes[i], ops);
+    return 0;
+}
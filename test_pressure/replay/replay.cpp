@@ -0,0 +1,525 @@
+//抓包回放工具，回放服务器-r选项录制的./TrafficCapture
+//按连接还原请求流并切分为完整请求，每个录制的连接对应一个回放连接，保持连接上的请求顺序
+//服务器不支持管线化，同一连接上收到上一个响应后才发送下一个请求，来不及发送的计为滞后(lag)
+//-s 1按原速，-s N按N倍速，-s 0不按时间、以-c个并发连接尽快回放
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "../../log/capture.h"
+
+using namespace std;
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+struct options
+{
+    const char *host;
+    int port;
+    const char *file;
+    double speed;           //0为尽快回放
+    int concurrency;        //尽快回放时的并发连接数
+    int timeout_ms;         //等待响应超时
+};
+
+static options g_opt;
+static sockaddr_in g_addr;
+
+struct request
+{
+    long long t;            //首字节到达时刻(相对抓包开始)
+    string data;
+};
+
+struct session
+{
+    vector<request> reqs;
+    long long close_t;      //客户端关闭时刻，-1表示抓包中没有关闭记录
+    string pending;         //装载时尚未凑成完整请求的数据
+    long long pending_t;
+
+    size_t next;            //下一个待发送的请求
+    int fd;
+    bool connecting;
+    bool waiting;           //已发送请求，等待响应
+    long long sent_at;
+    string out;
+    size_t out_off;
+    string in;
+    bool done;
+};
+
+struct stat_t
+{
+    long long sent;
+    long long responses;
+    long long status_err;
+    long long errors;
+    long long connects;
+    long long truncated;    //抓包末尾不完整的请求
+    long long dropped;      //抓包时丢弃的记录
+    vector<unsigned int> latencies;
+    vector<unsigned int> lags;
+};
+
+static vector<session> g_sessions;
+static stat_t g_stat;
+
+//在缓冲区中找出一个完整请求，返回其长度，不完整返回0
+static size_t request_length(const string &buf)
+{
+    size_t head_end = buf.find("\r\n\r\n");
+    if (head_end == string::npos)
+        return 0;
+    long len = 0;
+    const char *cl = strcasestr(buf.c_str(), "\r\nContent-Length:");
+    if (cl && (size_t)(cl - buf.c_str()) < head_end)
+        len = atol(cl + 17);
+    size_t total = head_end + 4 + len;
+    return buf.size() >= total ? total : 0;
+}
+
+static bool first_request_before(const session &a, const session &b)
+{
+    return a.reqs[0].t < b.reqs[0].t;
+}
+
+static bool load(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL)
+    {
+        perror(file);
+        return false;
+    }
+    char magic[8];
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, CAPTURE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s: not a capture file\n", file);
+        fclose(fp);
+        return false;
+    }
+
+    unordered_map<uint64_t, size_t> index;
+    capture_record rec;
+    vector<char> data;
+    while (fread(&rec, 1, sizeof(rec), fp) == sizeof(rec))
+    {
+        if (rec.conn == CAPTURE_DROPPED)
+        {
+            g_stat.dropped += rec.len;
+            continue;
+        }
+        data.resize(rec.len);
+        if (rec.len && fread(&data[0], 1, rec.len, fp) != rec.len)
+            break;
+
+        //同一连接标识在关闭后不会复用，关闭之后的记录视为新连接
+        unordered_map<uint64_t, size_t>::iterator it = index.find(rec.conn);
+        if (it == index.end() || g_sessions[it->second].close_t >= 0)
+        {
+            session s;
+            s.close_t = -1;
+            s.pending_t = 0;
+            g_sessions.push_back(s);
+            index[rec.conn] = g_sessions.size() - 1;
+            it = index.find(rec.conn);
+        }
+        session &s = g_sessions[it->second];
+        if (rec.len == 0)
+        {
+            s.close_t = rec.t_us;
+            continue;
+        }
+        if (s.pending.empty())
+            s.pending_t = rec.t_us;
+        s.pending.append(&data[0], rec.len);
+        size_t n;
+        while ((n = request_length(s.pending)) > 0)
+        {
+            request r;
+            r.t = s.pending_t;
+            r.data = s.pending.substr(0, n);
+            s.reqs.push_back(r);
+            s.pending.erase(0, n);
+            s.pending_t = rec.t_us;
+        }
+    }
+    fclose(fp);
+
+    //去掉没有完整请求的连接(如只连接未发送)，按第一个请求的时刻排序
+    vector<session> kept;
+    for (size_t i = 0; i < g_sessions.size(); ++i)
+    {
+        session &s = g_sessions[i];
+        if (!s.pending.empty())
+            ++g_stat.truncated;
+        s.pending.clear();
+        if (s.reqs.empty())
+            continue;
+        s.next = 0;
+        s.fd = -1;
+        s.connecting = false;
+        s.waiting = false;
+        s.sent_at = 0;
+        s.out_off = 0;
+        s.done = false;
+        kept.push_back(s);
+    }
+    g_sessions.swap(kept);
+    sort(g_sessions.begin(), g_sessions.end(), first_request_before);
+    return true;
+}
+
+static bool open_conn(int epfd, session &s)
+{
+    s.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s.fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(s.fd, (sockaddr *)&g_addr, sizeof(g_addr));
+    if (ret < 0 && errno != EINPROGRESS)
+    {
+        close(s.fd);
+        s.fd = -1;
+        return false;
+    }
+    s.connecting = ret < 0;
+    s.in.clear();
+    ++g_stat.connects;
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = &s;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s.fd, &ev);
+    return true;
+}
+
+//只在连接建立中或有未发完的数据时关注可写，避免空闲连接反复触发
+static void watch_out(int epfd, session &s, bool out)
+{
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (out ? EPOLLOUT : 0);
+    ev.data.ptr = &s;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, s.fd, &ev);
+}
+
+//关闭连接，等待中的请求计为错误并跳过
+static void close_conn(int epfd, session &s)
+{
+    if (s.fd >= 0)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, s.fd, NULL);
+        close(s.fd);
+        s.fd = -1;
+    }
+    if (s.waiting)
+    {
+        ++g_stat.errors;
+        s.waiting = false;
+        ++s.next;
+    }
+    s.out.clear();
+    s.out_off = 0;
+}
+
+static bool flush_out(session &s)
+{
+    while (s.out_off < s.out.size())
+    {
+        ssize_t n = send(s.fd, s.out.data() + s.out_off, s.out.size() - s.out_off, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN;
+        s.out_off += n;
+    }
+    s.out.clear();
+    s.out_off = 0;
+    return true;
+}
+
+//解析响应，完整时返回1，不完整返回0，报文错误返回-1
+static int parse_response(session &s, long long now)
+{
+    size_t head_end = s.in.find("\r\n\r\n");
+    if (head_end == string::npos)
+        return 0;
+    long len = 0;
+    const char *cl = strcasestr(s.in.c_str(), "\r\nContent-Length:");
+    if (cl && (size_t)(cl - s.in.c_str()) < head_end)
+        len = atol(cl + 17);
+    size_t total = head_end + 4 + len;
+    if (s.in.size() < total)
+        return 0;
+
+    int status = 0;
+    if (sscanf(s.in.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+    if (status < 200 || status >= 300)
+        ++g_stat.status_err;
+    ++g_stat.responses;
+    long long lat = now - s.sent_at;
+    g_stat.latencies.push_back(lat > 0xffffffffLL ? 0xffffffffu : (unsigned int)lat);
+    s.in.erase(0, total);
+    s.waiting = false;
+    ++s.next;
+    return 1;
+}
+
+//按倍速换算的计划时刻，尽快回放时为0
+static long long due(long long begin, long long t0, long long t)
+{
+    if (g_opt.speed <= 0)
+        return 0;
+    return begin + (long long)((t - t0) / g_opt.speed);
+}
+
+static void run()
+{
+    int epfd = epoll_create1(0);
+    vector<epoll_event> events(1024);
+    vector<session *> active;
+    size_t opened = 0;
+    long long t0 = g_sessions[0].reqs[0].t;
+    long long begin = now_us();
+    char buf[65536];
+
+    while (opened < g_sessions.size() || !active.empty())
+    {
+        long long now = now_us();
+
+        //到时的连接开始回放；尽快回放时按并发数补充
+        while (opened < g_sessions.size())
+        {
+            session &s = g_sessions[opened];
+            if (g_opt.speed > 0 ? due(begin, t0, s.reqs[0].t) > now : (int)active.size() >= g_opt.concurrency)
+                break;
+            active.push_back(&s);
+            ++opened;
+        }
+
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            session &s = *active[i];
+            if (s.waiting)
+            {
+                if (now - s.sent_at > g_opt.timeout_ms * 1000LL)
+                    close_conn(epfd, s);
+                continue;
+            }
+            if (s.next < s.reqs.size())
+            {
+                long long d = due(begin, t0, s.reqs[s.next].t);
+                if (d > now)
+                    continue;
+                //服务器关闭了连接或尚未建立，重新连接
+                if (s.fd < 0 && !open_conn(epfd, s))
+                {
+                    ++g_stat.errors;
+                    ++s.next;
+                    continue;
+                }
+                if (s.connecting)
+                    continue;
+                if (d > 0)
+                    g_stat.lags.push_back(now - d > 0xffffffffLL ? 0xffffffffu : (unsigned int)(now - d));
+                s.out = s.reqs[s.next].data;
+                s.out_off = 0;
+                s.waiting = true;
+                s.sent_at = now;
+                ++g_stat.sent;
+                if (!flush_out(s))
+                    close_conn(epfd, s);
+                else if (!s.out.empty())
+                    watch_out(epfd, s, true);
+                continue;
+            }
+            //请求全部完成，按录制的关闭时刻关闭连接
+            if (s.close_t < 0 || due(begin, t0, s.close_t) <= now)
+            {
+                close_conn(epfd, s);
+                s.done = true;
+            }
+        }
+        size_t k = 0;
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            if (!active[i]->done)
+                active[k++] = active[i];
+        }
+        active.resize(k);
+
+        int n = epoll_wait(epfd, &events[0], events.size(), 1);
+        now = now_us();
+        for (int i = 0; i < n; ++i)
+        {
+            session &s = *(session *)events[i].data.ptr;
+            if (s.fd < 0)
+                continue;
+            if (s.connecting && (events[i].events & (EPOLLOUT | EPOLLERR)))
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err)
+                {
+                    close_conn(epfd, s);
+                    ++g_stat.errors;
+                    ++s.next;
+                    continue;
+                }
+                s.connecting = false;
+                watch_out(epfd, s, false);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                if (!flush_out(s))
+                {
+                    close_conn(epfd, s);
+                    continue;
+                }
+                if (s.out.empty())
+                    watch_out(epfd, s, false);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                bool closed = false;
+                while (true)
+                {
+                    ssize_t r = recv(s.fd, buf, sizeof(buf), 0);
+                    if (r > 0)
+                    {
+                        s.in.append(buf, r);
+                        continue;
+                    }
+                    closed = r == 0 || errno != EAGAIN;
+                    break;
+                }
+                if (s.waiting && parse_response(s, now) < 0)
+                    closed = true;
+                //短连接由服务器在响应后关闭，下一个请求重新连接
+                if (closed)
+                    close_conn(epfd, s);
+            }
+        }
+    }
+    close(epfd);
+}
+
+static void print_quantiles(const char *name, vector<unsigned int> &v)
+{
+    if (v.empty())
+        return;
+    sort(v.begin(), v.end());
+    const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    printf("%s", name);
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); ++i)
+        printf("  p%g %u", qs[i] * 100, v[min(v.size() - 1, (size_t)(qs[i] * v.size()))]);
+    printf("  max %u\n", v.back());
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-s speed] [-c concurrency] [-o timeout_ms] capture_file\n"
+            "  -s 1 original timing, N for N times faster, 0 as fast as possible (default 1)\n"
+            "  -c concurrent connections when -s 0 (default 100)\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    g_opt.host = "127.0.0.1";
+    g_opt.port = 9006;
+    g_opt.speed = 1;
+    g_opt.concurrency = 100;
+    g_opt.timeout_ms = 10000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:c:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h': g_opt.host = optarg; break;
+        case 'p': g_opt.port = atoi(optarg); break;
+        case 's': g_opt.speed = atof(optarg); break;
+        case 'c': g_opt.concurrency = atoi(optarg); break;
+        case 'o': g_opt.timeout_ms = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || g_opt.concurrency <= 0)
+        usage(argv[0]);
+    g_opt.file = argv[optind];
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_opt.port);
+    if (inet_pton(AF_INET, g_opt.host, &g_addr.sin_addr) != 1)
+    {
+        hostent *h = gethostbyname(g_opt.host);
+        if (h == NULL)
+        {
+            fprintf(stderr, "unknown host %s\n", g_opt.host);
+            return 1;
+        }
+        memcpy(&g_addr.sin_addr, h->h_addr, sizeof(g_addr.sin_addr));
+    }
+
+    if (!load(g_opt.file))
+        return 1;
+    if (g_sessions.empty())
+    {
+        fprintf(stderr, "%s: no complete requests\n", g_opt.file);
+        return 1;
+    }
+
+    long long requests = 0, last = 0;
+    for (size_t i = 0; i < g_sessions.size(); ++i)
+    {
+        requests += g_sessions[i].reqs.size();
+        last = max(last, g_sessions[i].reqs.back().t);
+    }
+    long long span = last - g_sessions[0].reqs[0].t;
+    printf("capture    %zu connections  %lld requests  span %.2fs  truncated %lld  dropped %lld\n",
+           g_sessions.size(), requests, span / 1e6, g_stat.truncated, g_stat.dropped);
+
+    long long begin = now_us();
+    run();
+    double secs = (now_us() - begin) / 1e6;
+
+    if (g_opt.speed > 0)
+        printf("replay     %s:%d  speed %gx  %.2fs\n", g_opt.host, g_opt.port, g_opt.speed, secs);
+    else
+        printf("replay     %s:%d  max speed  %d connections  %.2fs\n", g_opt.host, g_opt.port, g_opt.concurrency, secs);
+    printf("requests   %lld sent (%.1f/s)  %lld responses  non-2xx %lld  errors %lld  connects %lld\n",
+           g_stat.sent, g_stat.sent / secs, g_stat.responses, g_stat.status_err, g_stat.errors, g_stat.connects);
+    if (g_stat.latencies.empty())
+    {
+        printf("latency    no responses\n");
+        return 1;
+    }
+    print_quantiles("latency(us)", g_stat.latencies);
+    //请求因上一个响应未返回而晚于计划时刻发送的时长
+    print_quantiles("lag(us)    ", g_stat.lags);
+    return 0;
+}
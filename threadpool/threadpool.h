@@ -2,11 +2,24 @@
 #define THREADPOOL_H
 
 #include <list>
+#include <vector>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <sched.h>
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../log/access_log.h"
+#include "../trace/probes.h"
+
+//把线程绑定到一个CPU上
+inline bool pin_thread(pthread_t tid, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return 0 == pthread_setaffinity_np(tid, sizeof(set), &set);
+}
 
 //线程池
 template <typename T>
@@ -14,16 +27,26 @@ class threadpool
 {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int actor_model, connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    /*cpus非空时第i个线程绑定到cpus[i % cpus.size()]*/
+    threadpool(int actor_model, int thread_number = 8, int max_request = 10000, const std::vector<int> &cpus = std::vector<int>());
     ~threadpool();
     //添加任务到请求队列
     bool append(T *request, int state);
     bool append_p(T *request);
+    //请求队列中等待的任务数
+    int queue_size();
+    //工作线程完成一次读写或处理后的回调，在工作线程中调用，arg为设置时传入的参数
+    void set_done(void (*fn)(T *, void *), void *arg)
+    {
+        m_done = fn;
+        m_done_arg = arg;
+    }
 
 private:
     /*工作线程运行的函数，它不断从请求队列中取出任务并执行之*/
     static void *worker(void *arg);
-    void run();
+    //ACTOR为并发模型，线程启动时选定，循环中不再判断
+    template <int ACTOR> void run();
 
 private:
     int m_thread_number;        //线程池中的线程数
@@ -32,14 +55,15 @@ private:
     std::list<T *> m_workqueue; //请求队列
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //是否有任务需要处理
-    connection_pool *m_connPool;  //数据库
     int m_actor_model;          //模型切换
+    void (*m_done)(T *, void *);
+    void *m_done_arg;
 };
 
 //线程池构造函数初始化
 template <typename T>
-threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int thread_number, int max_requests) 
-: m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool( int actor_model, int thread_number, int max_requests, const std::vector<int> &cpus) 
+: m_actor_model(actor_model),m_thread_number(thread_number), m_max_requests(max_requests), m_threads(NULL), m_done(NULL), m_done_arg(NULL)
 {
     //线程池的大小或请求队列的大小不合法则抛出错误
     if (thread_number <= 0 || max_requests <= 0)
@@ -57,6 +81,9 @@ threadpool<T>::threadpool( int actor_model, connection_pool *connPool, int threa
             delete[] m_threads;
             throw std::exception();
         }
+        //绑定失败(CPU不存在或不在允许的集合中)时线程照常运行，不绑定
+        if (!cpus.empty())
+            pin_thread(m_threads[i], cpus[i % cpus.size()]);
         //将线程设置为分离状态
         if (pthread_detach(m_threads[i]))
         {
@@ -72,6 +99,14 @@ threadpool<T>::~threadpool()
     delete[] m_threads;
 }
 
+template <typename T>
+int threadpool<T>::queue_size()
+{
+    m_queuelocker.lock();
+    int n = m_workqueue.size();
+    m_queuelocker.unlock();
+    return n;
+}
 template <typename T>
 bool threadpool<T>::append(T *request, int state)
 {
@@ -85,6 +120,8 @@ bool threadpool<T>::append(T *request, int state)
     }
     //设置读写
     request->m_state = state;
+    if (0 == state)
+        request->m_t_enqueue = monotonic_us();
     //将请求加入请求队列
     m_workqueue.push_back(request);
     //解锁
@@ -105,6 +142,7 @@ bool threadpool<T>::append_p(T *request)
         return false;
     }
     //加入工作队列中
+    request->m_t_enqueue = monotonic_us();
     m_workqueue.push_back(request);
     //解锁
     m_queuelocker.unlock();
@@ -118,10 +156,14 @@ void *threadpool<T>::worker(void *arg)
     //创建一个指针指向线程池数组中的线程
     threadpool *pool = (threadpool *)arg;
     //调用动态调用线程的run函数
-    pool->run();
+    if (1 == pool->m_actor_model)
+        pool->template run<1>();
+    else
+        pool->template run<0>();
     return pool;
 }
 template <typename T>
+template <int ACTOR>
 void threadpool<T>::run()
 {
     while (true)
@@ -144,40 +186,34 @@ void threadpool<T>::run()
 
         if (!request)
             continue;
+        if (0 == ACTOR || 0 == request->m_state)
+            request->m_t_dequeue = monotonic_us();
+        PROBE2(dequeue, request, request->m_state);
         //为1模型时
-        if (1 == m_actor_model)
+        if constexpr (1 == ACTOR)
         {
+            //读写失败置timer_flag，由主循环在完成回调之后关闭连接
             if (0 == request->m_state)
             {
                 if (request->read_once())
-                {
-                    request->improv = 1;
-                    connectionRAII mysqlcon(&request->mysql, m_connPool);
                     request->process();
-                }
                 else
-                {
-                    request->improv = 1;
                     request->timer_flag = 1;
-                }
             }
             else
             {
-                if (request->write())
-                {
-                    request->improv = 1;
-                }
-                else
-                {
-                    request->improv = 1;
+                if (!request->write())
                     request->timer_flag = 1;
-                }
             }
+            if (m_done)
+                m_done(request, m_done_arg);
         }
         else
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
+            //数据库连接由do_request在需要时自行获取
             request->process();
+            if (m_done)
+                m_done(request, m_done_arg);
         }
     }
 }
@@ -1,10 +1,13 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../metrics/metrics.h"
+#include "../trace/probes.h"
 
 sort_timer_lst::sort_timer_lst()
 {
     head = NULL;
     tail = NULL;
+    m_size = 0;
 }
 sort_timer_lst::~sort_timer_lst()
 {
@@ -23,6 +26,7 @@ void sort_timer_lst::add_timer(util_timer *timer)       //添加定时器，内
     {
         return;
     }
+    ++m_size;
     if (!head)
     {
         head = tail = timer;
@@ -43,6 +47,27 @@ void sort_timer_lst::adjust_timer(util_timer *timer)    //调整定时器，任
     {
         return;
     }
+    //超时时间提前(如请求头时限早于空闲时限)，取出后从表头重新插入
+    util_timer *prev = timer->prev;
+    if (prev && timer->expire < prev->expire)
+    {
+        prev->next = timer->next;
+        if (timer->next)
+            timer->next->prev = prev;
+        else
+            tail = prev;
+        timer->prev = NULL;
+        timer->next = NULL;
+        if (timer->expire < head->expire)
+        {
+            timer->next = head;
+            head->prev = timer;
+            head = timer;
+        }
+        else
+            add_timer(timer, head);
+        return;
+    }
     util_timer *tmp = timer->next;
     if (!tmp || (timer->expire < tmp->expire))
     {
@@ -68,6 +93,7 @@ void sort_timer_lst::del_timer(util_timer *timer)   //删除定时器
     {
         return;
     }
+    --m_size;
     if ((timer == head) && (timer == tail))     //链表中只有一个定时器，需要删除该定时器
     {
         delete timer;
@@ -93,7 +119,7 @@ void sort_timer_lst::del_timer(util_timer *timer)   //删除定时器
     timer->next->prev = timer->prev;
     delete timer;
 }
-void sort_timer_lst::tick()
+void sort_timer_lst::tick(bool (*busy)(client_data *, void *), void *arg)
 {
     if (!head)
     {
@@ -108,7 +134,18 @@ void sort_timer_lst::tick()
         {
             break;
         }
+        if (busy && busy(tmp->user_data, arg))
+        {
+            //推迟后不再早于当前时间，本轮遍历到它时结束
+            tmp->expire = cur + 1;
+            adjust_timer(tmp);
+            tmp = head;
+            continue;
+        }
         tmp->cb_func(tmp->user_data);   //当前定时器到期，则调用回调函数，执行定时事件
+        Metrics::get_instance()->inc(C_TIMEOUTS);
+        PROBE1(timer_expire, tmp->user_data->sockfd);
+        --m_size;
         head = tmp->next;               //将处理后的定时器从链表中删除，并重置头节点
         if (head)
         {
@@ -119,6 +156,21 @@ void sort_timer_lst::tick()
     }
 }
 
+void sort_timer_lst::close_if(bool (*pred)(client_data *, void *), void *arg)
+{
+    util_timer *tmp = head;
+    while (tmp)
+    {
+        util_timer *next = tmp->next;
+        if (!pred || pred(tmp->user_data, arg))
+        {
+            tmp->cb_func(tmp->user_data);
+            del_timer(tmp);
+        }
+        tmp = next;
+    }
+}
+
 //私有成员，被公有成员add_timer和adjust_time调用，主要用于调整链表内部节点
 void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head)
 {
@@ -161,36 +213,20 @@ int Utils::setnonblocking(int fd)
 }
 
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
+void Utils::addfd(event_engine *engine, int fd, bool one_shot, int TRIGMode)
 {
-    epoll_event event;
-    event.data.fd = fd;
-
+    uint32_t events;
     if (1 == TRIGMode)
-        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        events = EPOLLIN | EPOLLET | EPOLLRDHUP;
     else
-        event.events = EPOLLIN | EPOLLRDHUP;
+        events = EPOLLIN | EPOLLRDHUP;
 
     if (one_shot)
-        event.events |= EPOLLONESHOT;
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+        events |= EPOLLONESHOT;
+    engine->add(fd, events);
     setnonblocking(fd);
 }
 
-//信号处理函数
-void Utils::sig_handler(int sig)
-{
-    //为保证函数的可重入性，保留原来的errno
-    //可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据
-    int save_errno = errno;
-    int msg = sig;
-    //将信号值从管道写端写入，传输字符类型，而非整型
-    send(u_pipefd[1], (char *)&msg, 1, 0);
-
-    //将原来的errno赋值为当前的errno
-    errno = save_errno;
-}
-
 //设置信号函数
 void Utils::addsig(int sig, void(handler)(int), bool restart)
 {
@@ -198,7 +234,6 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
     struct sigaction sa;
     memset(&sa, '\0', sizeof(sa));
 
-    //信号处理函数中仅仅发送信号值，不做对应逻辑处理
     sa.sa_handler = handler;
     if (restart)
         sa.sa_flags |= SA_RESTART;
@@ -210,9 +245,9 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
 }
 
 //定时处理任务，重新定时以不断触发SIGALRM信号
-void Utils::timer_handler()
+void Utils::timer_handler(bool (*busy)(client_data *, void *), void *arg)
 {
-    m_timer_lst.tick();
+    m_timer_lst.tick(busy, arg);
     alarm(m_TIMESLOT);
 }
 
@@ -222,14 +257,17 @@ void Utils::show_error(int connfd, const char *info)
     close(connfd);
 }
 
-int *Utils::u_pipefd = 0;
-int Utils::u_epollfd = 0;
+event_engine *Utils::u_engine = NULL;
 
 class Utils;
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);   //删除非活动连接在socket上的注册事件
+    PROBE1(conn_close, user_data->sockfd);
+    Utils::u_engine->del(user_data->sockfd);   //删除非活动连接在socket上的注册事件
     assert(user_data);
     close(user_data->sockfd);       //关闭文件描述符
     http_conn::m_user_count--;      //减少连接数
+    overload::GetInstance()->conn_close(user_data->address.sin_addr.s_addr);
+    //工作线程持有的连接不会在这里关闭(见conn_busy)；对端关闭等情况下交回的结果按timer与连接代数忽略
+    user_data->timer = NULL;
 }
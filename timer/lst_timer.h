@@ -22,7 +22,9 @@
 #include <sys/uio.h>
 
 #include <time.h>
+#include <atomic>
 #include "../log/log.h"
+#include "../event/event_engine.h"
 
 class util_timer;
 
@@ -56,13 +58,19 @@ public:
     void add_timer(util_timer *timer);
     void adjust_timer(util_timer *timer);
     void del_timer(util_timer *timer);
-    void tick();
+    //关闭到期的连接；busy为真的连接(如正在等待数据库结果)推迟到下一次检查
+    void tick(bool (*busy)(client_data *, void *) = NULL, void *arg = NULL);
+    //关闭pred为真的连接，pred为NULL时全部关闭，用于停机排空
+    void close_if(bool (*pred)(client_data *, void *), void *arg);
+    //链表中的定时器数，供运行指标读取
+    int size() const { return m_size.load(std::memory_order_relaxed); }
 
 private:
     void add_timer(util_timer *timer, util_timer *lst_head);
 
     util_timer *head;
     util_timer *tail;
+    std::atomic<int> m_size;
 };
 
 class Utils
@@ -77,23 +85,19 @@ public:
     int setnonblocking(int fd);
 
     //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-    void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
-
-    //信号处理函数
-    static void sig_handler(int sig);
+    void addfd(event_engine *engine, int fd, bool one_shot, int TRIGMode);
 
     //设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
     //定时处理任务，重新定时以不断触发SIGALRM信号
-    void timer_handler();
+    void timer_handler(bool (*busy)(client_data *, void *) = NULL, void *arg = NULL);
 
     void show_error(int connfd, const char *info);
 
 public:
-    static int *u_pipefd;
     sort_timer_lst m_timer_lst;
-    static int u_epollfd;
+    static event_engine *u_engine;
     int m_TIMESLOT;
 };
 
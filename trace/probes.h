@@ -0,0 +1,35 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+//静态探针(USDT)
+//make USDT=1编译时展开为sys/sdt.h的DTRACE_PROBEn，只在二进制中留下一条nop和.note.stapsdt记录，
+//未挂载时开销可忽略；不开启或系统没有sys/sdt.h(systemtap-sdt-dev)时展开为空
+//查看与使用：
+//  readelf -n ./server | grep -A2 stapsdt
+//  bpftrace -e 'usdt:./server:webserver:write_done { @bytes = hist(arg1); }'
+//  perf probe -x ./server sdt_webserver:accept && perf record -e sdt_webserver:accept -a
+
+#if defined(USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WEBSERVER_USDT 1
+#else
+#warning "USDT requested but <sys/sdt.h> not found, probes disabled"
+#endif
+#endif
+
+#ifdef WEBSERVER_USDT
+#define PROBE0(name) DTRACE_PROBE(webserver, name)
+#define PROBE1(name, a1) DTRACE_PROBE1(webserver, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(webserver, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(webserver, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(webserver, name, a1, a2, a3, a4)
+#else
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a1) do {} while (0)
+#define PROBE2(name, a1, a2) do {} while (0)
+#define PROBE3(name, a1, a2, a3) do {} while (0)
+#define PROBE4(name, a1, a2, a3, a4) do {} while (0)
+#endif
+
+#endif
@@ -2,8 +2,15 @@
 
 WebServer::WebServer()
 {
-    //http_conn类对象
-    users = new http_conn[MAX_FD];
+    //http_conn类对象和定时器数据在cpu_affinity中分配
+    users = NULL;
+    users_timer = NULL;
+    m_listenfd = -1;
+    m_sigfd = -1;
+    m_wakefd = -1;
+    m_done_queue = NULL;
+    m_cgi_queue = NULL;
+    m_sql_exec = NULL;
 
     //root文件夹路径
     char server_path[200];
@@ -14,35 +21,114 @@ WebServer::WebServer()
     strcat(m_root, root);
 
     //m_root字符串为tinywebserve/root目录的路径
-    //定时器
-    users_timer = new client_data[MAX_FD];
 }
 
 WebServer::~WebServer()
 {
-    close(m_epollfd);
-    close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
+    //先停数据库执行器：已提交的任务执行完、线程全部退出后才能释放存储后端，任务完成时还会写m_wakefd
+    if (m_sql_exec)
+        m_sql_exec->stop();
+    //先把后写队列中的注册用户落库，排空剩余的时间(不在排空中则为一个排空时限)用于重试，仍失败的写入溢出文件
+    if (m_user_writer)
+    {
+        long long wait_s = m_draining ? m_drain_deadline - time(NULL) : m_drain_timeout;
+        m_user_writer->stop(wait_s > 0 ? wait_s * 1000 : 0);
+    }
+    delete m_user_writer;
+    delete m_engine;
+    //排空时已关闭
+    if (m_listenfd >= 0)
+        close(m_listenfd);
+    if (m_sigfd >= 0)
+        close(m_sigfd);
+    if (m_wakefd >= 0)
+        close(m_wakefd);
     delete[] users;
     delete[] users_timer;
     delete m_pool;
+    delete m_done_queue;
+    delete m_sql_exec;
+    delete m_store;
+    //执行器停止前完成、主循环来不及处理的任务
+    if (m_cgi_queue)
+    {
+        m_cgi_tasks.clear();
+        while (m_cgi_queue->pop_batch(m_cgi_tasks, MAX_EVENT_NUMBER, 0) > 0)
+        {
+            for (size_t i = 0; i < m_cgi_tasks.size(); ++i)
+                delete m_cgi_tasks[i];
+            m_cgi_tasks.clear();
+        }
+    }
+    delete m_cgi_queue;
+}
+
+//解析"0,2-5"形式的CPU列表，非法项忽略
+static void parse_cpus(const char *str, vector<int> &cpus)
+{
+    cpus.clear();
+    while (*str)
+    {
+        char *end;
+        long lo = strtol(str, &end, 10);
+        long hi = lo;
+        if (end == str)
+            break;
+        if ('-' == *end)
+        {
+            str = end + 1;
+            hi = strtol(str, &end, 10);
+            if (end == str)
+                break;
+        }
+        for (long cpu = lo; cpu <= hi; ++cpu)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                cpus.push_back(cpu);
+        }
+        str = (',' == *end) ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            break;
+    }
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int sql_min_num, int user_flush_ms, int store_backend, int session_ttl, int thread_num, int close_log, int actor_model,
+                     int access_sample, int access_slow_ms, int capture_mb, int event_engine, int backlog, int defer_accept,
+                     int overload_ms, int ip_conn_limit, int ip_rate, int drain_timeout, string cpus,
+                     int header_timeout, int body_rate, int write_timeout, int idle_timeout)
 {
     m_port = port;
     m_user = user;
     m_passWord = passWord;
     m_databaseName = databaseName;
     m_sql_num = sql_num;
+    m_sql_min_num = sql_min_num;
+    m_user_flush_ms = user_flush_ms;
+    m_store_backend = store_backend;
+    m_session_ttl = session_ttl;
     m_thread_num = thread_num;
     m_log_write = log_write;
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_access_sample = access_sample;
+    m_access_slow_ms = access_slow_ms;
+    m_capture_mb = capture_mb;
+    m_event_engine = event_engine;
+    m_backlog = backlog;
+    m_defer_accept = defer_accept;
+    m_overload_ms = overload_ms;
+    m_ip_conn_limit = ip_conn_limit;
+    m_ip_rate = ip_rate;
+    m_drain_timeout = drain_timeout;
+    parse_cpus(cpus.c_str(), m_cpus);
+    m_header_timeout = header_timeout;
+    m_body_rate = body_rate;
+    m_write_timeout = write_timeout;
+    m_idle_timeout = idle_timeout;
+    m_draining = false;
 }
 
 void WebServer::trig_mode()
@@ -83,28 +169,180 @@ void WebServer::log_write()
         else
             Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
     }
+
+    //访问日志独立于运行日志，按采样率开启
+    if (m_access_sample > 0)
+        AccessLog::get_instance()->init("./AccessLog", m_access_sample, m_access_slow_ms);
+
+    //请求抓包，供test_pressure/replay回放
+    if (m_capture_mb > 0)
+        Capture::get_instance()->init("./TrafficCapture", m_capture_mb);
 }
 
 void WebServer::sql_pool()
 {
-    //初始化数据库连接池
+    //初始化数据库连接池，只有MySQL后端需要
     m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    //启动时只建立最小连接数，连不上数据库也继续运行，由连接池后台线程重试
+    if (user_store::STORE_MYSQL == m_store_backend &&
+        !m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log, m_sql_min_num))
+        LOG_ERROR("%s", "MySQL unavailable at startup, connections will be retried");
+
+    //用户凭据存储后端
+    m_store = user_store::create(m_store_backend, m_connPool, "./UserStore", m_close_log);
+    if (!m_store)
+    {
+        LOG_ERROR("%s", "user store init failure");
+        exit(1);
+    }
+    http_conn::m_store = m_store;
+
+    //数据库执行器，线程数与连接数一致，注册写库不再占用http工作线程
+    m_sql_exec = new sql_executor(m_sql_num);
+    http_conn::m_sql_exec = m_sql_exec;
+
+    //注册后写：新用户先进内存表，攒批后批量写入存储后端
+    m_user_writer = NULL;
+    if (m_user_flush_ms > 0)
+        m_user_writer = new user_writer(m_store, m_close_log, "./UserSpill", 64, m_user_flush_ms);
+    http_conn::m_user_writer = m_user_writer;
+
+    //把已有用户加载到内存表
+    if (!m_store->load(user_table::GetInstance()))
+        LOG_ERROR("load users from %s store failed", m_store->name());
+    //上次退出时未能落库的注册用户
+    user_writer::replay(m_store, "./UserSpill", m_close_log);
+}
 
-    //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+//SIGALRM为定时器，SIGTERM/SIGHUP排空退出，SIGUSR1输出状态，SIGUSR2热升级
+//屏蔽后由主循环从signalfd读出，工作线程、日志线程等不会被信号打断，也不会在任意线程里执行处理函数
+void WebServer::block_signals()
+{
+    sigemptyset(&m_sigmask);
+    sigaddset(&m_sigmask, SIGALRM);
+    sigaddset(&m_sigmask, SIGTERM);
+    sigaddset(&m_sigmask, SIGHUP);
+    sigaddset(&m_sigmask, SIGUSR1);
+    sigaddset(&m_sigmask, SIGUSR2);
+    int ret = pthread_sigmask(SIG_BLOCK, &m_sigmask, NULL);
+    assert(ret == 0);
 }
 
+//Reactor模式下工作线程完成读写后调用，把连接交给主循环处理定时器
+static void worker_done(http_conn *conn, void *arg)
+{
+    WebServer *server = (WebServer *)arg;
+    conn_done done;
+    done.sockfd = conn - server->users;
+    //先取代数再交还连接，交还之后对象可能被主循环关闭和复用
+    done.gen = conn->conn_gen();
+    conn->leave_worker();
+    //每个连接同一时刻只有一个任务，队列容量为MAX_FD，不会长时间满
+    while (!server->m_done_queue->push(done))
+        sched_yield();
+    //计数只在溢出时写失败，此时主循环必然还有未处理的唤醒
+    uint64_t one = 1;
+    ssize_t ret = write(server->m_wakefd, &one, sizeof(one));
+    (void)ret;
+}
+
+//主循环线程在eventLoop开始时绑定；这里先临时绑定到同一个CPU再分配连接对象和定时器数据，
+//按first-touch策略页面落在主循环所在的NUMA节点，之后恢复原来的掩码，
+//使随后创建的日志、数据库等辅助线程不继承主循环的绑定
+void WebServer::cpu_affinity()
+{
+    cpu_set_t saved;
+    bool pinned = false;
+    if (!m_cpus.empty() && 0 == pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved))
+        pinned = pin_thread(pthread_self(), m_cpus[0]);
+
+    users = new http_conn[MAX_FD];
+    users_timer = new client_data[MAX_FD];
+
+    if (pinned)
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+}
+
+void WebServer::session()
+{
+    //登录会话有效期
+    session_table::GetInstance()->init(m_session_ttl);
+    overload::GetInstance()->init(m_overload_ms, m_ip_conn_limit, m_ip_rate);
+}
+
+//主循环独占第一个CPU，只给了一个CPU时工作线程也绑在上面
 void WebServer::thread_pool()
 {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    vector<int> worker_cpus;
+    if (m_cpus.size() > 1)
+        worker_cpus.assign(m_cpus.begin() + 1, m_cpus.end());
+    else
+        worker_cpus = m_cpus;
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num, 10000, worker_cpus);
 }
 
-void WebServer::eventListen()
+//运行指标的瞬时值，arg为对应模块
+static long gauge_connections(void *)
+{
+    return http_conn::m_user_count;
+}
+static long gauge_queue_depth(void *arg)
+{
+    return ((threadpool<http_conn> *)arg)->queue_size();
+}
+static long gauge_int(void *arg)
+{
+    return *(int *)arg;
+}
+static long gauge_timers(void *arg)
+{
+    return ((sort_timer_lst *)arg)->size();
+}
+static long gauge_users(void *)
+{
+    return user_table::GetInstance()->size();
+}
+static long gauge_sql_free(void *arg)
+{
+    return ((connection_pool *)arg)->GetFreeConn();
+}
+static long gauge_sql_total(void *arg)
+{
+    return ((connection_pool *)arg)->GetTotalConn();
+}
+static long gauge_sql_pending(void *arg)
+{
+    return ((sql_executor *)arg)->pending();
+}
+static long gauge_writer_pending(void *arg)
+{
+    return ((user_writer *)arg)->pending();
+}
+
+void WebServer::metrics()
+{
+    //注册瞬时值，GET /metrics时读取
+    Metrics *metrics = Metrics::get_instance();
+    metrics->add_gauge("webserver_connections", "Open client connections.", gauge_connections, NULL);
+    metrics->add_gauge("webserver_threadpool_queue_depth", "Requests waiting in the thread pool queue.", gauge_queue_depth, m_pool);
+    metrics->add_gauge("webserver_threadpool_threads", "Worker threads.", gauge_int, &m_thread_num);
+    metrics->add_gauge("webserver_timers", "Timers in the inactive-connection list.", gauge_timers, &utils.m_timer_lst);
+    metrics->add_gauge("webserver_users", "Users in the in-memory user table.", gauge_users, NULL);
+    if (user_store::STORE_MYSQL == m_store_backend)
+    {
+        metrics->add_gauge("webserver_sql_pool_free", "Idle connections in the DB pool.", gauge_sql_free, m_connPool);
+        metrics->add_gauge("webserver_sql_pool_total", "Open connections in the DB pool.", gauge_sql_total, m_connPool);
+    }
+    metrics->add_gauge("webserver_sql_executor_pending", "Tasks waiting for a DB executor thread.", gauge_sql_pending, m_sql_exec);
+    if (m_user_writer)
+        metrics->add_gauge("webserver_user_writer_pending", "Registrations not yet persisted.", gauge_writer_pending, m_user_writer);
+}
+
+void WebServer::create_listenfd()
 {
     //网络编程基础步骤
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    m_listenfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     assert(m_listenfd >= 0);
 
     //TCP连接断开的时候调用closesocket函数，有优雅的断开和强制断开两种方式
@@ -143,42 +381,96 @@ void WebServer::eventListen()
     //>=0的设定 因为只有小于0才是错误情况
     assert(ret >= 0);
     //>=0的设定 因为只有小于0才是错误情况
-    ret = listen(m_listenfd, 5);
+    ret = listen(m_listenfd, m_backlog);
     assert(ret >= 0);
+}
 
-    utils.init(TIMESLOT);
+//热升级的新进程或systemd socket激活时，监听套接字已由父进程放在LISTEN_FDS_START
+static bool inherit_listenfd()
+{
+    const char *fds = getenv("LISTEN_FDS");
+    const char *pid = getenv("LISTEN_PID");
+    bool ok = fds && pid && atoi(fds) >= 1 && atoi(pid) == getpid();
+    //不再传给之后启动的进程
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_PID");
+    return ok;
+}
+
+void WebServer::eventListen()
+{
+    m_upgrade_pid = 0;
+    bool inherited = inherit_listenfd();
+    if (inherited)
+    {
+        m_listenfd = LISTEN_FDS_START;
+        fcntl(m_listenfd, F_SETFD, FD_CLOEXEC);
+        //重新listen只更新监听队列长度，已排队的连接不受影响
+        int ret = listen(m_listenfd, m_backlog);
+        assert(ret >= 0);
+        LOG_INFO("inherited listen fd %d", m_listenfd);
+    }
+    else
+        create_listenfd();
 
-    //epoll创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    m_epollfd = epoll_create(5);
-    assert(m_epollfd != -1);
+    //连接上有数据到达(或超过defer_accept秒)才唤醒accept，只连接不发送的客户端不占用连接对象
+    if (m_defer_accept > 0)
+        setsockopt(m_listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &m_defer_accept, sizeof(m_defer_accept));
+    //多个进程以SO_REUSEPORT共享端口时，内核优先把连接交给与收包CPU一致的监听套接字
+    if (!m_cpus.empty())
+        setsockopt(m_listenfd, SOL_SOCKET, SO_INCOMING_CPU, &m_cpus[0], sizeof(int));
+    m_accept_more = false;
+    m_engine_accept = false;
 
+    utils.init(TIMESLOT);
+
+    //创建事件引擎，io_uring不可用时退回epoll
+    m_engine = event_engine::create(m_event_engine, MAX_FD, http_conn::READ_BUFFER_SIZE);
+    assert(m_engine != NULL);
+    LOG_INFO("event engine: %s", m_engine->name());
 
-    //将lfd上树
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
-    http_conn::m_epollfd = m_epollfd;
+    //将lfd上树，引擎能在内核中完成accept时由引擎接管
+    m_engine_accept = m_engine->add_listener(m_listenfd);
+    if (m_engine_accept)
+    {
+        LOG_INFO("%s", "accept completed by event engine");
+    }
+    else
+        utils.addfd(m_engine, m_listenfd, false, m_LISTENTrigmode);
+    http_conn::m_engine = m_engine;
+    http_conn::m_header_timeout = m_header_timeout;
+    http_conn::m_body_rate = m_body_rate;
+    http_conn::m_write_timeout = m_write_timeout;
+    http_conn::m_idle_timeout = m_idle_timeout;
     
-    //创建管道套接字
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret != -1);
-    //设置管道写端为非阻塞，为什么写端要非阻塞？
-    //send是将信息发送给套接字缓冲区，如果缓冲区满了，则会阻塞，
-    //这时候会进一步增加信号处理函数的执行时间，为此，将其修改为非阻塞。
-    utils.setnonblocking(m_pipefd[1]);
-
-    //设置管道读端为ET非阻塞
-    utils.addfd(m_epollfd, m_pipefd[0], false, 0);
-
-    //传递给主循环的信号值，这里只关注SIGALRM和SIGTERM
+    //被屏蔽的信号只能通过signalfd读出，与其他事件一起在主循环中处理，不再需要信号处理函数和管道
+    m_sigfd = signalfd(-1, &m_sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(m_sigfd != -1);
+    utils.addfd(m_engine, m_sigfd, false, 0);
     utils.addsig(SIGPIPE, SIG_IGN);
-    utils.addsig(SIGALRM, utils.sig_handler, false);
-    utils.addsig(SIGTERM, utils.sig_handler, false);
+
+    //数据库线程完成的任务放入队列，再通过eventfd唤醒主循环，连接只在主循环中恢复
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(m_wakefd != -1);
+    utils.addfd(m_engine, m_wakefd, false, 0);
+    m_cgi_queue = new mpsc_queue<cgi_task *>(MAX_FD);
+    http_conn::m_cgi_done = m_cgi_queue;
+    http_conn::m_wakefd = m_wakefd;
+
+    //工作线程也把处理完的连接放入队列，由主循环按处理后的阶段调整定时器，主循环不必等待工作线程
+    m_done_queue = new mpsc_queue<conn_done>(MAX_FD);
+    m_pool->set_done(worker_done, this);
 
     alarm(TIMESLOT);
 
     //工具类,信号和描述符基础操作
-    Utils::u_pipefd = m_pipefd;
-    Utils::u_epollfd = m_epollfd;
+    Utils::u_engine = m_engine;
+
+    //热升级启动的新进程已可以accept，通知旧进程排空退出
+    const char *old_pid = getenv("WEBSERVER_UPGRADE_PID");
+    if (inherited && old_pid && atoi(old_pid) == getppid())
+        kill(getppid(), SIGTERM);
+    unsetenv("WEBSERVER_UPGRADE_PID");
 }
 
 void WebServer::timer(int connfd, struct sockaddr_in client_address)
@@ -193,17 +485,17 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address)
     timer->user_data = &users_timer[connfd];    //绑定用户数据
     timer->cb_func = cb_func;                   //设置回调函数
     time_t cur = time(NULL);                    //获取当前时间
-    timer->expire = cur + 3 * TIMESLOT;         //设置超时时间
+    timer->expire = users[connfd].deadline(cur); //设置超时时间，新连接为空闲时限
     users_timer[connfd].timer = timer;          
     utils.m_timer_lst.add_timer(timer);         //添加定时器到链表中
 }
 
-//若有数据传输，则将定时器往后延迟3个单位
+//若有数据传输，按连接所处阶段重新计算超时时间(读请求头时不延后，发送和空闲时延后)
 //并对新的定时器在链表上的位置进行调整
 void WebServer::adjust_timer(util_timer *timer)
 {
     time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
+    timer->expire = users[timer->user_data->sockfd].deadline(cur);
     utils.m_timer_lst.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
@@ -220,128 +512,222 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
     LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
 
+//每轮最多accept ACCEPT_BATCH个连接，连接风暴时不会长时间不处理已有连接上的读写
+//LT下未取完的连接会再次触发监听事件；ET下不会，由m_accept_more让主循环在本轮事件之后继续
+//accept4直接得到非阻塞的连接，不再单独fcntl
+//引擎已在内核中完成accept时不再调用accept4，取出本轮得到的全部连接
+template <int LISTEN_TRIG>
 bool WebServer::dealclinetdata()
 {
+    //排空中监听套接字已关闭，同一轮中残留的监听事件直接忽略
+    if (m_draining)
+        return false;
+    take_accepted();
+
     struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
-    if (0 == m_LISTENTrigmode)
+    socklen_t client_addrlength;
+    int connfd;
+    m_accept_more = false;
+    for (int i = 0; i < ACCEPT_BATCH && !m_engine_accept; ++i)
     {
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        client_addrlength = sizeof(client_address);
+        connfd = accept4(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
-            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            //客户端在accept之前已断开，跳过
+            if (errno == ECONNABORTED || errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD)
-        {
-            utils.show_error(connfd, "Internal server busy");
-            LOG_ERROR("%s", "Internal server busy");
+        if (!add_client(connfd, client_address))
             return false;
-        }
-        timer(connfd, client_address);
-    }
-
-    else
-    {
-        while (1)
-        {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0)
-            {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD)
-            {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
-        }
-        return false;
     }
+    m_accept_more = (1 == LISTEN_TRIG) && !m_engine_accept;
     return true;
 }
 
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+//取出引擎已accept的连接
+void WebServer::take_accepted()
 {
-    int ret = 0;
-    int sig;
-    char signals[1024];
-    ret = recv(m_pipefd[0], signals, sizeof(signals), 0);   //从管道读端读出信号值，成功返回字节数，失败返回-1
-    if (ret == -1)
+    struct sockaddr_in client_address;
+    int connfd;
+    while ((connfd = m_engine->take_accept(&client_address)) >= 0)
+        add_client(connfd, client_address);
+}
+
+//新连接的准入检查，通过后初始化连接与定时器；连接数已满时返回false，本轮不再accept
+bool WebServer::add_client(int connfd, const sockaddr_in &client_address)
+{
+    Metrics::get_instance()->inc(C_ACCEPTS);
+    //收包所在的CPU与主循环不一致时，报文要跨核(可能跨NUMA节点)交给主循环，应调整网卡中断亲和性
+    if (!m_cpus.empty())
     {
-        return false;
+        int rx_cpu = -1;
+        socklen_t len = sizeof(rx_cpu);
+        if (0 == getsockopt(connfd, SOL_SOCKET, SO_INCOMING_CPU, &rx_cpu, &len) && rx_cpu != m_cpus[0])
+            Metrics::get_instance()->inc(C_RX_CPU_REMOTE);
     }
-    else if (ret == 0)
+    PROBE2(accept, connfd, http_conn::m_user_count);
+    if (http_conn::m_user_count >= MAX_FD)
     {
+        overload::reject(connfd);
+        close(connfd);
+        Metrics::get_instance()->inc(C_SHED_MAX_FD);
+        LOG_ERROR("%s", "Internal server busy");
         return false;
     }
-    else
+    //超过单ip并发上限，连接关闭时在cb_func中归还
+    if (!overload::GetInstance()->conn_open(client_address.sin_addr.s_addr))
+    {
+        overload::reject(connfd);
+        close(connfd);
+        Metrics::get_instance()->inc(C_SHED_IP_CONN);
+        return true;
+    }
+    timer(connfd, client_address);
+    return true;
+}
+
+bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+{
+    signalfd_siginfo infos[16];
+    //signalfd每次读出若干个完整的signalfd_siginfo，读到EAGAIN为止
+    while (true)
     {
-        for (int i = 0; i < ret; ++i)
+        ssize_t ret = read(m_sigfd, infos, sizeof(infos));
+        if (ret < 0)
+            return errno == EAGAIN;
+        if (ret < (ssize_t)sizeof(signalfd_siginfo))
+            return false;
+
+        int n = ret / sizeof(signalfd_siginfo);
+        for (int i = 0; i < n; ++i)
         {
-            switch (signals[i])
+            switch (infos[i].ssi_signo)
             {
             case SIGALRM:               //接收到SIGALRM信号，timeout设置为true
             {
                 timeout = true;
                 break;
             }
-            case SIGTERM:               //接收到SIGTERM信号，终止程序运行，stop_server设置为true
+            case SIGTERM:               //接收到SIGTERM或SIGHUP信号，先排空已有连接；未开启排空或排空中再次收到则立即退出
+            case SIGHUP:
+            {
+                if (m_drain_timeout > 0 && !m_draining)
+                    start_drain();
+                else
+                    stop_server = true;
+                break;
+            }
+            case SIGUSR1:               //接收到SIGUSR1信号，在日志中输出当前状态
+            {
+                LOG_INFO("status: %d connections, %d timers, %d queued requests%s", (int)http_conn::m_user_count,
+                         utils.m_timer_lst.size(), m_pool->queue_size(), m_draining ? ", draining" : "");
+                break;
+            }
+            case SIGUSR2:               //接收到SIGUSR2信号，热升级
             {
-                stop_server = true;
+                upgrade();
                 break;
             }
             }
         }
     }
-    return true;
 }
 
-void WebServer::dealwithread(int sockfd)
+void WebServer::dealwithdone()
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    //先清零计数再取队列，取完之后才入队的连接会再次唤醒主循环
+    uint64_t count;
+    if (read(m_wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOG_ERROR("read eventfd failed, errno is:%d", errno);
 
-    //reactor   
-    if (1 == m_actormodel)
+    m_cgi_tasks.clear();
+    while (m_cgi_queue->pop_batch(m_cgi_tasks, MAX_EVENT_NUMBER, 0) > 0)
     {
-        if (timer)
+        for (size_t i = 0; i < m_cgi_tasks.size(); ++i)
         {
-            adjust_timer(timer);
+            cgi_task *task = m_cgi_tasks[i];
+            int sockfd = task->conn - users;
+            util_timer *timer = users_timer[sockfd].timer;
+            //生成响应后进入发送阶段，按发送时限重新计时
+            if (timer && users[sockfd].resume_cgi(*task))
+                adjust_timer(timer);
+            delete task;
         }
+        m_cgi_tasks.clear();
+    }
 
-        //若监测到读事件，将该事件放入请求队列
-        m_pool->append(users + sockfd, 0);
-
-        while (true)
+    m_done.clear();
+    while (m_done_queue->pop_batch(m_done, MAX_EVENT_NUMBER, 0) > 0)
+    {
+        for (size_t i = 0; i < m_done.size(); ++i)
         {
-            if (1 == users[sockfd].improv)
+            int sockfd = m_done[i].sockfd;
+            util_timer *timer = users_timer[sockfd].timer;
+            //连接已被定时器或对端关闭，或fd已被新连接复用
+            if (!timer || users[sockfd].conn_gen() != m_done[i].gen)
+                continue;
+            //又交给了工作线程，由那一次交回时处理，期间不读取连接的状态
+            if (users[sockfd].in_worker())
+                continue;
+            if (1 == users[sockfd].timer_flag)
             {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
+                deal_timer(timer, sockfd);
+                users[sockfd].timer_flag = 0;
+            }
+            //读写和处理由工作线程完成，之后才能确定连接所处的阶段
+            else
+            {
+                adjust_timer(timer);
             }
         }
+        m_done.clear();
+    }
+}
+
+template <int ACTOR, int CONN_TRIG>
+void WebServer::dealwithread(int sockfd)
+{
+    util_timer *timer = users_timer[sockfd].timer;
+    PROBE2(deal_read, sockfd, ACTOR);
+
+    //reactor
+    if constexpr (1 == ACTOR)
+    {
+        //若监测到读事件，将该事件放入请求队列，定时器在工作线程完成后由dealwithdone处理；队列已满时直接拒绝
+        //入队前标记为工作线程所有，处理完之前定时器和停机排空不会关闭该连接
+        users[sockfd].enter_worker();
+        if (!m_pool->append(users + sockfd, 0))
+        {
+            users[sockfd].leave_worker();
+            overload::reject(sockfd);
+            Metrics::get_instance()->inc(C_SHED_QUEUE_FULL);
+            deal_timer(timer, sockfd);
+        }
     }
     else
     {
         //proactor
-        if (users[sockfd].read_once())
+        if (users[sockfd].read_once<CONN_TRIG>())
         {
             LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
 
-            //若监测到读事件，将该事件放入请求队列
-            m_pool->append_p(users + sockfd);
-
+            //有数据传输，按所处阶段调整定时器；必须在入队之前，入队后连接的状态由工作线程修改
+            //处理期间定时器不关闭该连接，处理完由dealwithdone按新的阶段重新计时
             if (timer)
+                adjust_timer(timer);
+            users[sockfd].enter_worker();
+            //若监测到读事件，将该事件放入请求队列
+            if (!m_pool->append_p(users + sockfd))
             {
-                adjust_timer(timer);    //有数据传输，则将定时器向后延3个单位，并对新的定时器在链表上的位置进行调整
+                users[sockfd].leave_worker();
+                overload::reject(sockfd);
+                Metrics::get_instance()->inc(C_SHED_QUEUE_FULL);
+                deal_timer(timer, sockfd);
+                return;
             }
         }
         else
@@ -351,31 +737,21 @@ void WebServer::dealwithread(int sockfd)
     }
 }
 
+template <int ACTOR>
 void WebServer::dealwithwrite(int sockfd)
 {
     util_timer *timer = users_timer[sockfd].timer;
+    PROBE2(deal_write, sockfd, ACTOR);
     //reactor
-    if (1 == m_actormodel)
+    if constexpr (1 == ACTOR)
     {
-        if (timer)
+        //发送已开始，队列满时无法再改为503，只能关闭
+        users[sockfd].enter_worker();
+        if (!m_pool->append(users + sockfd, 1))
         {
-            adjust_timer(timer);
-        }
-
-        m_pool->append(users + sockfd, 1);
-
-        while (true)
-        {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
+            users[sockfd].leave_worker();
+            Metrics::get_instance()->inc(C_SHED_QUEUE_FULL);
+            deal_timer(timer, sockfd);
         }
     }
     else
@@ -387,7 +763,7 @@ void WebServer::dealwithwrite(int sockfd)
 
             if (timer)
             {
-                adjust_timer(timer);        //有数据传输，则将定时器向后延3个单位，并对新的定时器在链表上的位置进行调整
+                adjust_timer(timer);        //有数据传输，按所处阶段调整定时器，并对新的定时器在链表上的位置进行调整
             }
         }
         else
@@ -397,14 +773,128 @@ void WebServer::dealwithwrite(int sockfd)
     }
 }
 
-void WebServer::eventLoop()
+static bool conn_idle(client_data *user_data, void *arg)
+{
+    return ((http_conn *)arg)[user_data->sockfd].idle();
+}
+
+//工作线程正在处理或等待数据库结果的连接，定时器到期也不关闭
+static bool conn_busy(client_data *user_data, void *arg)
+{
+    http_conn &conn = ((http_conn *)arg)[user_data->sockfd];
+    return conn.in_worker() || conn.cgi_pending();
+}
+
+void WebServer::start_drain()
+{
+    m_draining = true;
+    m_drain_deadline = time(NULL) + m_drain_timeout;
+    m_accept_more = false;
+    http_conn::m_draining.store(true, memory_order_relaxed);
+
+    //热升级时新进程持有同一个监听套接字，尚未accept的连接由新进程接手
+    m_engine->del(m_listenfd);
+    close(m_listenfd);
+    m_listenfd = -1;
+
+    //空闲的长连接直接关闭；进行中的请求处理完后以Connection: close响应，发送完即关闭
+    utils.m_timer_lst.close_if(conn_idle, users);
+    //引擎在撤销accept之前已取得的连接还没有读到请求，不算空闲，照常处理
+    take_accepted();
+    LOG_INFO("draining %d connections, deadline %ds", utils.m_timer_lst.size(), m_drain_timeout);
+}
+
+//新进程与本进程的参数、工作目录相同，监听套接字放在LISTEN_FDS_START，
+//以LISTEN_FDS/LISTEN_PID告知(与systemd socket激活相同)，新进程开始监听后向本进程发送SIGTERM
+//fork之后的子进程只调用异步信号安全的函数，参数与环境变量在fork之前准备好
+void WebServer::upgrade()
+{
+    if (m_draining || m_upgrade_pid > 0)
+    {
+        LOG_ERROR("%s", "upgrade already in progress");
+        return;
+    }
+
+    //命令行参数取自/proc/self/cmdline，以\0分隔
+    string cmdline;
+    FILE *fp = fopen("/proc/self/cmdline", "re");
+    if (fp == NULL)
+        return;
+    char buf[1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        cmdline.append(buf, n);
+    fclose(fp);
+    vector<char *> argv;
+    for (size_t i = 0; i < cmdline.size(); i += strlen(&cmdline[i]) + 1)
+        argv.push_back(&cmdline[i]);
+    argv.push_back(NULL);
+
+    vector<string> env;
+    for (char **e = environ; *e; ++e)
+    {
+        if (strncmp(*e, "LISTEN_", 7) != 0 && strncmp(*e, "WEBSERVER_UPGRADE_PID=", 22) != 0)
+            env.push_back(*e);
+    }
+    env.push_back("LISTEN_FDS=1");
+    env.push_back("WEBSERVER_UPGRADE_PID=" + to_string(getpid()));
+    //LISTEN_PID在子进程中填入自己的pid
+    env.push_back("LISTEN_PID=0000000000");
+    vector<char *> envp;
+    for (size_t i = 0; i < env.size(); ++i)
+        envp.push_back(&env[i][0]);
+    envp.push_back(NULL);
+    char *listen_pid = envp[env.size() - 1] + strlen("LISTEN_PID=");
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        LOG_ERROR("upgrade: fork failed, errno is:%d", errno);
+        return;
+    }
+    if (0 == pid)
+    {
+        int self = getpid();
+        for (int i = 9; i >= 0; --i, self /= 10)
+            listen_pid[i] = '0' + self % 10;
+        if (m_listenfd == LISTEN_FDS_START)
+            fcntl(m_listenfd, F_SETFD, 0);
+        else
+            dup2(m_listenfd, LISTEN_FDS_START);
+        //信号处理函数在exec后恢复默认，屏蔽字会被继承
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        execvpe(argv[0], &argv[0], &envp[0]);
+        _exit(127);
+    }
+    m_upgrade_pid = pid;
+    LOG_INFO("upgrade: started new process %d", pid);
+}
+
+//触发模式与并发模型作为模板参数，每种组合各实例化一份主循环，循环内不再判断模式
+template <int LISTEN_TRIG, int CONN_TRIG, int ACTOR>
+void WebServer::event_loop()
 {
     bool timeout = false;               //超时默认为false
     bool stop_server = false;
 
+    if (!m_cpus.empty())
+    {
+        if (pin_thread(pthread_self(), m_cpus[0]))
+        {
+            LOG_INFO("main loop bound to cpu %d", m_cpus[0]);
+        }
+        else
+        {
+            LOG_ERROR("bind main loop to cpu %d failed", m_cpus[0]);
+        }
+    }
+
     while (!stop_server)
     {
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);   //监测发生事件的文件描述符
+        //上一批accept未取完时不阻塞，处理完已就绪的事件后继续accept；排空中每秒检查一次是否结束
+        int number = m_engine->wait(events, MAX_EVENT_NUMBER, m_accept_more ? 0 : (m_draining ? 1000 : -1));   //监测发生事件的文件描述符
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
@@ -418,40 +908,87 @@ void WebServer::eventLoop()
             //处理新到的客户连接
             if (sockfd == m_listenfd)
             {
-                bool flag = dealclinetdata();
+                bool flag = dealclinetdata<LISTEN_TRIG>();
                 if (false == flag)
                     continue;
             }
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) //处理异常事件
-            {
-                //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
-            }
-            //处理定时器信号
-            else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
+            //处理信号
+            else if (sockfd == m_sigfd)
             {
                 bool flag = dealwithsignal(timeout, stop_server);
                 if (false == flag)
-                    LOG_ERROR("%s", "dealclientdata failure");
+                    LOG_ERROR("%s", "dealwithsignal failure");
+            }
+            //处理工作线程完成的连接
+            else if (sockfd == m_wakefd)
+            {
+                dealwithdone();
+            }
+            //同一批中先处理的事件已关闭该连接，剩下的事件作废
+            else if (!users_timer[sockfd].timer)
+            {
+                continue;
+            }
+            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) //处理异常事件
+            {
+                //服务器端关闭连接，移除对应的定时器；工作线程还持有该连接时，由dealwithdone在它交回后关闭
+                util_timer *timer = users_timer[sockfd].timer;
+                if (users[sockfd].in_worker())
+                    users[sockfd].timer_flag = 1;
+                else
+                    deal_timer(timer, sockfd);
             }
             //处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
-                dealwithread(sockfd);
+                dealwithread<ACTOR, CONN_TRIG>(sockfd);
             }
             else if (events[i].events & EPOLLOUT)
             {
-                dealwithwrite(sockfd);
+                dealwithwrite<ACTOR>(sockfd);
             }
         }
+        if (1 == LISTEN_TRIG && m_accept_more)
+            dealclinetdata<LISTEN_TRIG>();
         if (timeout)    //处理定时器为非必须事件，收到信号并不是马上处理，而是完成读写事件后再进行处理
         {
-            utils.timer_handler();
+            utils.timer_handler(conn_busy, users);
+            session_table::GetInstance()->expire();
+            overload::GetInstance()->expire();
 
             LOG_INFO("%s", "timer tick");
 
+            //新进程未能启动时回收，允许再次升级
+            if (m_upgrade_pid > 0 && waitpid(m_upgrade_pid, NULL, WNOHANG) == m_upgrade_pid)
+            {
+                LOG_ERROR("upgrade: new process %d exited", m_upgrade_pid);
+                m_upgrade_pid = 0;
+            }
+
             timeout = false;
         }
+        //所有连接都已关闭，或超过时限放弃剩余的连接
+        if (m_draining && (0 == utils.m_timer_lst.size() || time(NULL) >= m_drain_deadline))
+        {
+            LOG_INFO("drain finished, %d connections left", utils.m_timer_lst.size());
+            stop_server = true;
+        }
+    }
+}
+
+void WebServer::eventLoop()
+{
+    //启动时按配置选择一次实例
+    int mode = ((1 == m_LISTENTrigmode) << 2) | ((1 == m_CONNTrigmode) << 1) | (1 == m_actormodel);
+    switch (mode)
+    {
+    case 0: event_loop<0, 0, 0>(); break;
+    case 1: event_loop<0, 0, 1>(); break;
+    case 2: event_loop<0, 1, 0>(); break;
+    case 3: event_loop<0, 1, 1>(); break;
+    case 4: event_loop<1, 0, 0>(); break;
+    case 5: event_loop<1, 0, 1>(); break;
+    case 6: event_loop<1, 1, 0>(); break;
+    case 7: event_loop<1, 1, 1>(); break;
     }
 }
\ No newline at end of file
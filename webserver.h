@@ -3,6 +3,7 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -11,13 +12,28 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <vector>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./log/mpsc_queue.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
 const int TIMESLOT = 5;             //最小超时单位
+const int ACCEPT_BATCH = 64;        //每轮最多accept的连接数
+const int LISTEN_FDS_START = 3;     //继承的监听套接字所在的fd，与systemd socket激活一致
+
+//工作线程处理完的连接，gen为交回时的连接代数，连接已关闭或复用后才交回的结果据此丢弃
+struct conn_done
+{
+    int sockfd;
+    unsigned int gen;
+};
 
 class WebServer
 {
@@ -27,21 +43,40 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int sql_min_num, int user_flush_ms, int store_backend, int session_ttl, int thread_num, int close_log, int actor_model,
+              int access_sample, int access_slow_ms, int capture_mb, int event_engine, int backlog, int defer_accept,
+              int overload_ms, int ip_conn_limit, int ip_rate, int drain_timeout, string cpus,
+              int header_timeout, int body_rate, int write_timeout, int idle_timeout);
 
+    //屏蔽由signalfd接收的信号，须在创建任何线程之前调用，之后的线程都继承该屏蔽字
+    void block_signals();
+    void cpu_affinity();
     void thread_pool();
     void sql_pool();
+    void session();
+    void metrics();
     void log_write();
     void trig_mode();
     void eventListen();
+    void create_listenfd();
     void eventLoop();
     void timer(int connfd, struct sockaddr_in client_address);
+    bool add_client(int connfd, const sockaddr_in &client_address);
+    void take_accepted();
     void adjust_timer(util_timer *timer);
     void deal_timer(util_timer *timer, int sockfd);
-    bool dealclinetdata();
+    //以下模板的参数为监听/连接的触发模式(0为LT，1为ET)和并发模型(0为Proactor，1为Reactor)
+    template <int LISTEN_TRIG> bool dealclinetdata();
     bool dealwithsignal(bool& timeout, bool& stop_server);
-    void dealwithread(int sockfd);
-    void dealwithwrite(int sockfd);
+    //取出数据库线程完成的登录/注册并生成响应；Reactor模式下还取出工作线程已完成的连接，调整或删除其定时器
+    void dealwithdone();
+    template <int ACTOR, int CONN_TRIG> void dealwithread(int sockfd);
+    template <int ACTOR> void dealwithwrite(int sockfd);
+    template <int LISTEN_TRIG, int CONN_TRIG, int ACTOR> void event_loop();
+    //SIGTERM：停止accept，处理完进行中的请求，关闭空闲长连接，超过时限强制退出
+    void start_drain();
+    //SIGUSR2：以相同参数启动新进程并把监听套接字交给它
+    void upgrade();
 
 public:
     //基础
@@ -50,9 +85,27 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
+    int m_access_sample;
+    int m_access_slow_ms;
+    int m_capture_mb;
+    int m_overload_ms;
+    int m_ip_conn_limit;
+    int m_ip_rate;
+    int m_header_timeout;
+    int m_body_rate;
+    int m_write_timeout;
+    int m_idle_timeout;
+    vector<int> m_cpus;     //m_cpus[0]为主循环，其余为工作线程，空为不绑定
 
-    int m_pipefd[2];
-    int m_epollfd;
+    sigset_t m_sigmask;     //由signalfd接收的信号
+    int m_sigfd;
+    int m_wakefd;           //工作线程完成读写、数据库线程完成任务后唤醒主循环的eventfd
+    mpsc_queue<conn_done> *m_done_queue;
+    vector<conn_done> m_done;
+    mpsc_queue<cgi_task *> *m_cgi_queue;
+    vector<cgi_task *> m_cgi_tasks;
+    event_engine *m_engine;
+    int m_event_engine;
     http_conn *users;
 
     //数据库相关
@@ -61,6 +114,13 @@ public:
     string m_passWord;     //登陆数据库密码
     string m_databaseName; //使用数据库名
     int m_sql_num;
+    int m_sql_min_num;
+    sql_executor *m_sql_exec;
+    user_writer *m_user_writer;
+    int m_user_flush_ms;
+    int m_store_backend;
+    int m_session_ttl;
+    user_store *m_store;
 
     //线程池相关
     threadpool<http_conn> *m_pool;
@@ -70,6 +130,14 @@ public:
     epoll_event events[MAX_EVENT_NUMBER];
 
     int m_listenfd;
+    int m_backlog;
+    int m_defer_accept;
+    bool m_accept_more;     //ET监听时上一批未取完，主循环处理完本轮事件后继续accept
+    bool m_engine_accept;   //由事件引擎在内核中accept，主循环只取出结果
+    int m_drain_timeout;
+    bool m_draining;
+    time_t m_drain_deadline;
+    pid_t m_upgrade_pid;    //热升级启动的新进程，新进程接管后本进程排空退出
     int m_OPT_LINGER;
     int m_TRIGMode;
     int m_LISTENTrigmode;